@@ -0,0 +1,87 @@
+// Compares the interpreter's string hash against the FNV-1a it replaced.
+//
+//   cc -O2 -o hash_bench bench/hash_bench.c && ./hash_bench
+//
+// For each key length it reports nanoseconds per hash and how evenly the
+// low bits (what Table uses to pick a bucket) spread similar keys.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../hash.h"
+
+#define KEY_COUNT 4096
+#define BUCKET_BITS 12
+
+static uint32_t hashFnv1a(const char* key, size_t length) {
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static uint32_t hashSeeded(const char* key, size_t length) {
+    return hashBytes32(key, length, 0x1234abcdull);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// keys look like identifiers that differ only in a trailing counter, the
+// common case for generated field and variable names
+static char** makeKeys(size_t length) {
+    char** keys = malloc(sizeof(char*) * KEY_COUNT);
+    for(int i = 0; i < KEY_COUNT; i++) {
+        keys[i] = malloc(length + 16);
+        memset(keys[i], 'k', length);
+        char suffix[16];
+        int n = snprintf(suffix, sizeof(suffix), "%d", i);
+        if((size_t)n > length) n = (int)length;
+        memcpy(keys[i] + length - n, suffix, n);
+    }
+    return keys;
+}
+
+static void run(const char* name, uint32_t (*hash)(const char*, size_t),
+                char** keys, size_t length) {
+    int iterations = length >= 1024 ? 50 : 2000;
+    volatile uint32_t sink = 0;
+
+    double start = now();
+    for(int it = 0; it < iterations; it++) {
+        for(int i = 0; i < KEY_COUNT; i++) sink ^= hash(keys[i], length);
+    }
+    double elapsed = now() - start;
+
+    static int buckets[1 << BUCKET_BITS];
+    memset(buckets, 0, sizeof(buckets));
+    int collisions = 0;
+    for(int i = 0; i < KEY_COUNT; i++) {
+        uint32_t bucket = hash(keys[i], length) & ((1 << BUCKET_BITS) - 1);
+        if(buckets[bucket]++ > 0) collisions++;
+    }
+
+    printf("  %-8s %8.2f ns/hash %8.2f GB/s  %5d bucket collisions\n", name,
+           elapsed * 1e9 / ((double)iterations * KEY_COUNT),
+           (double)length * iterations * KEY_COUNT / elapsed / 1e9, collisions);
+}
+
+int main() {
+    size_t lengths[] = {3, 8, 16, 32, 64, 256, 4096};
+    for(size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        char** keys = makeKeys(lengths[i]);
+        printf("length %zu\n", lengths[i]);
+        run("fnv1a", hashFnv1a, keys, lengths[i]);
+        run("wyhash", hashSeeded, keys, lengths[i]);
+        for(int k = 0; k < KEY_COUNT; k++) free(keys[k]);
+        free(keys);
+    }
+    return 0;
+}
@@ -17,6 +17,7 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
 
     if(chunk->capacity < chunk->count + 1) {
         int oldCapacity = chunk->capacity;
+        reserveHeap((sizeof(uint8_t) + sizeof(int)) * (GROW_CAPACITY(oldCapacity) - oldCapacity));
         chunk->capacity = GROW_CAPACITY(oldCapacity);
         chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
         chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
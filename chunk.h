@@ -42,8 +42,13 @@ typedef enum {
     OP_INHERIT,
     OP_GET_SUPER,
     OP_SUPER_INVOKE,
+    OP_BUILD_LIST,
+    OP_GET_INDEX,
+    OP_SET_INDEX,
 } OpCode;
 
+#define OP_COUNT (OP_SET_INDEX + 1)
+
 typedef struct{
     int count;
     int capacity;
@@ -6,13 +6,11 @@
 #include <stdint.h>
 
 #define UINT8_COUNT (UINT8_MAX+1)
-#define DEBUG_PRINT_CODE
-#define DEBUG_TRACE_EXECUTION
 
 #define NAN_BOXING
 
-/* #define DEBUG_GC_LOG */
-#define DEBUG_STRESS_GC
+// the debugging aids (printing code, tracing execution, stressing and
+// logging the GC) are runtime flags now, see main.c
 
 #endif
 
@@ -6,10 +6,7 @@
 #include "common.h"
 #include "scanner.h"
 #include "memory.h"
-
-#ifdef DEBUG_PRINT_CODE
 #include "debug.h"
-#endif
 
 typedef struct {
     Token name;
@@ -173,7 +170,10 @@ static void emitReturn() {
 }
 
 static uint8_t makeConstant(Value value) {
+    beginMutation();
     int index = addConstant(currentChunk(), value);
+    writeBarrier((Obj*)current->function);
+    endMutation();
     if(index > UINT8_MAX) {
         error("Too many constants in one chunk.");
         return 0;
@@ -202,14 +202,10 @@ static ObjFunction* endCompiler() {
     emitReturn();
     ObjFunction* function = current->function;
 
-#ifdef DEBUG_PRINT_CODE
-
-    if(!parser.hadError) {
+    if(vm.printCode && !parser.hadError) {
         disassembleChunk(currentChunk(), function->name != NULL ? function->name->chars : "<script>");
     }
 
-#endif
-
     current = current->enclosing;
     return function;
 }
@@ -230,7 +226,11 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
     current = compiler;
 
     if(type != TYPE_SCRIPT) {
-        current->function->name = copyString(parser.previous.start, parser.previous.length);
+        ObjString* name = copyString(parser.previous.start, parser.previous.length);
+        beginMutation();
+        current->function->name = name;
+        writeBarrier((Obj*)current->function);
+        endMutation();
     }
 
     Local* local = &current->locals[current->localCount++];
@@ -247,7 +247,7 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
 }
 
 static uint8_t identifierConstant(Token* name) {
-    return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+    return makeConstant(OBJ_VAL(copySymbol(name->start, name->length)));
 }
 
 static void addLocal(Token name) {
@@ -373,6 +373,35 @@ static void call(bool canAssign) {
     emitBytes(OP_CALL, argCount);
 }
 
+static void subscript(bool canAssign) {
+    expression();
+    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+    if(canAssign && match(TOKEN_EQUAL)) {
+        expression();
+        emitByte(OP_SET_INDEX);
+    } else {
+        emitByte(OP_GET_INDEX);
+    }
+}
+
+static void list(bool canAssign) {
+    uint8_t count = 0;
+
+    if(!check(TOKEN_RIGHT_BRACKET)) {
+        do {
+            expression();
+            if(count == 255) {
+                error("Can't have more than 255 items in a list literal.");
+            }
+            count++;
+        } while(match(TOKEN_COMMA));
+    }
+
+    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after list items.");
+    emitBytes(OP_BUILD_LIST, count);
+}
+
 static void grouping(bool canAssign){
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
@@ -411,7 +440,7 @@ static void literal(bool canAssign) {
 }
 
 static void string(bool canAssign) { 
-    emitConstant(OBJ_VAL(copyString(parser.previous.start+1, parser.previous.length-2)));
+    emitConstant(copyStringValue(parser.previous.start+1, parser.previous.length-2));
 }
 
 static int resolveLocal(Compiler* compiler, Token* name){
@@ -555,6 +584,8 @@ ParseRule rules[] = {
       [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
       [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE},
       [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
+      [TOKEN_LEFT_BRACKET]  = {list,     subscript, PREC_CALL},
+      [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
       [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
       [TOKEN_DOT]           = {NULL,     dot,    PREC_CALL},
       [TOKEN_MINUS]         = {unary,     binary,   PREC_TERM},
@@ -975,6 +1006,13 @@ ObjFunction* compile(const char* source) {
     return parser.hadError ? NULL : function;
 }
 
+void resetCompiler() {
+    // an out of memory error unwound out of compile(), leaving these
+    // pointing into its frames
+    current = NULL;
+    currentClass = NULL;
+}
+
 void markCompilerRoots() {
     Compiler* compiler = current;
     while(compiler != NULL) {
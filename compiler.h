@@ -7,5 +7,6 @@
 
 ObjFunction* compile(const char* source);
 void markCompilerRoots();
+void resetCompiler();
 
 #endif
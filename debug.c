@@ -4,6 +4,52 @@
 #include "value.h"
 #include "object.h"
 
+const char* opcodeName(uint8_t instruction) {
+    switch(instruction) {
+        case OP_POP: return "OP_POP";
+        case OP_ADD: return "OP_ADD";
+        case OP_SUBTRACT: return "OP_SUBTRACT";
+        case OP_DIVIDE: return "OP_DIVIDE";
+        case OP_MULTIPLY: return "OP_MULTIPLY";
+        case OP_NIL: return "OP_NIL";
+        case OP_FALSE: return "OP_FALSE";
+        case OP_NOT: return "OP_NOT";
+        case OP_TRUE: return "OP_TRUE";
+        case OP_NEGATE: return "OP_NEGATE";
+        case OP_EQUAL: return "OP_EQUAL";
+        case OP_GREATER: return "OP_GREATER";
+        case OP_LESS: return "OP_LESS";
+        case OP_CONSTANT: return "OP_CONSTANT";
+        case OP_RETURN: return "OP_RETURN";
+        case OP_PRINT: return "OP_PRINT";
+        case OP_DEFINE_GLOBAL: return "OP_DEFINE_GLOBAL";
+        case OP_SET_GLOBAL: return "OP_SET_GLOBAL";
+        case OP_GET_GLOBAL: return "OP_GET_GLOBAL";
+        case OP_SET_LOCAL: return "OP_SET_LOCAL";
+        case OP_GET_LOCAL: return "OP_GET_LOCAL";
+        case OP_JUMP_IF_FALSE: return "OP_JUMP_IF_FALSE";
+        case OP_JUMP: return "OP_JUMP";
+        case OP_LOOP: return "OP_LOOP";
+        case OP_CALL: return "OP_CALL";
+        case OP_GET_UPVALUE: return "OP_GET_UPVALUE";
+        case OP_SET_UPVALUE: return "OP_SET_UPVALUE";
+        case OP_CLOSURE: return "OP_CLOSURE";
+        case OP_CLOSE_UPVALUE: return "OP_CLOSE_UPVALUE";
+        case OP_CLASS: return "OP_CLASS";
+        case OP_GET_PROPERTY: return "OP_GET_PROPERTY";
+        case OP_SET_PROPERTY: return "OP_SET_PROPERTY";
+        case OP_METHOD: return "OP_METHOD";
+        case OP_INVOKE: return "OP_INVOKE";
+        case OP_INHERIT: return "OP_INHERIT";
+        case OP_GET_SUPER: return "OP_GET_SUPER";
+        case OP_SUPER_INVOKE: return "OP_SUPER_INVOKE";
+        case OP_BUILD_LIST: return "OP_BUILD_LIST";
+        case OP_GET_INDEX: return "OP_GET_INDEX";
+        case OP_SET_INDEX: return "OP_SET_INDEX";
+    }
+    return "OP_UNKNOWN";
+}
+
 void disassembleChunk(Chunk* chunk, const char* name) {
     printf("== %s ==\n",name);
 
@@ -63,6 +109,12 @@ int disassembleInstruction(Chunk* chunk, int offset) {
 
     uint8_t instruction = chunk->code[offset];
     switch(instruction) {
+        case OP_BUILD_LIST:
+            return byteInstruction("OP_BUILD_LIST", chunk, offset);
+        case OP_GET_INDEX:
+            return simpleInstruction("OP_GET_INDEX", offset);
+        case OP_SET_INDEX:
+            return simpleInstruction("OP_SET_INDEX", offset);
         case OP_SUPER_INVOKE: 
             return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
         case OP_GET_SUPER:
@@ -3,6 +3,7 @@
 
 #include "chunk.h"
 
+const char* opcodeName(uint8_t instruction);
 void disassembleChunk(Chunk* chunk, const char* name);
 int disassembleInstruction(Chunk* chunk, int offset);
 
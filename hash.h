@@ -0,0 +1,114 @@
+#ifndef clox_hash_h
+#define clox_hash_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Word-at-a-time string hash in the style of wyhash: input is consumed 8
+// or 16 bytes per step and every step folds a 64x64->128 bit multiply, so
+// short identifiers cost a couple of multiplies and long strings run far
+// faster than byte-at-a-time FNV-1a. The seed lets each process pick its
+// own hash function so colliding keys can't be precomputed.
+
+static const uint64_t hashSecret[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+    0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull,
+};
+
+static inline void hashMultiply(uint64_t* a, uint64_t* b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+static inline uint64_t hashMix(uint64_t a, uint64_t b) {
+    hashMultiply(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t hashRead8(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hashRead4(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hashBytes(const char* key, size_t length, uint64_t seed) {
+    const uint8_t* p = (const uint8_t*)key;
+    seed ^= hashMix(seed ^ hashSecret[0], hashSecret[1]);
+
+    uint64_t a, b;
+    if(length <= 16) {
+        if(length >= 4) {
+            // two overlapping reads from each end cover 4..16 bytes
+            size_t middle = (length >> 3) << 2;
+            a = (hashRead4(p) << 32) | hashRead4(p + middle);
+            b = (hashRead4(p + length - 4) << 32) | hashRead4(p + length - 4 - middle);
+        } else if(length > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = length;
+        if(i > 48) {
+            // three independent lanes keep the multipliers busy
+            uint64_t lane1 = seed, lane2 = seed;
+            do {
+                seed = hashMix(hashRead8(p) ^ hashSecret[1], hashRead8(p + 8) ^ seed);
+                lane1 = hashMix(hashRead8(p + 16) ^ hashSecret[2], hashRead8(p + 24) ^ lane1);
+                lane2 = hashMix(hashRead8(p + 32) ^ hashSecret[3], hashRead8(p + 40) ^ lane2);
+                p += 48;
+                i -= 48;
+            } while(i > 48);
+            seed ^= lane1 ^ lane2;
+        }
+
+        while(i > 16) {
+            seed = hashMix(hashRead8(p) ^ hashSecret[1], hashRead8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        a = hashRead8(p + i - 16);
+        b = hashRead8(p + i - 8);
+    }
+
+    a ^= hashSecret[1];
+    b ^= seed;
+    hashMultiply(&a, &b);
+    return hashMix(a ^ hashSecret[0] ^ length, b ^ hashSecret[1]);
+}
+
+static inline uint32_t hashBytes32(const char* key, size_t length, uint64_t seed) {
+    uint64_t hash = hashBytes(key, length, seed);
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// hashes a single 64-bit word such as a number's bits or a pointer
+static inline uint32_t hashWord(uint64_t word, uint64_t seed) {
+    uint64_t hash = hashMix(word ^ hashSecret[0], seed ^ hashSecret[1]);
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+#endif
@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "heap.h"
+#include "vm.h"
+
+// Freed slots are poisoned under AddressSanitizer, so a stale pointer into
+// the page heap is still caught the way one into malloc'd memory would be.
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define HEAP_ASAN
+#endif
+#elif defined(__SANITIZE_ADDRESS__)
+#define HEAP_ASAN
+#endif
+
+#ifdef HEAP_ASAN
+#include <sanitizer/asan_interface.h>
+#define POISON(address, size) ASAN_POISON_MEMORY_REGION(address, size)
+#define UNPOISON(address, size) ASAN_UNPOISON_MEMORY_REGION(address, size)
+#else
+#define POISON(address, size) ((void)(address), (void)(size))
+#define UNPOISON(address, size) ((void)(address), (void)(size))
+#endif
+
+#define SLOTS_OFFSET heapSlotSize(sizeof(Page))
+
+static void makeAvailable(SizeClass* sizeClass, Page* page) {
+    page->isAvailable = true;
+    page->prevAvailable = NULL;
+    page->nextAvailable = sizeClass->available;
+    if(sizeClass->available != NULL) sizeClass->available->prevAvailable = page;
+    sizeClass->available = page;
+}
+
+static void makeUnavailable(SizeClass* sizeClass, Page* page) {
+    page->isAvailable = false;
+    if(page->prevAvailable != NULL) {
+        page->prevAvailable->nextAvailable = page->nextAvailable;
+    } else {
+        sizeClass->available = page->nextAvailable;
+    }
+    if(page->nextAvailable != NULL) page->nextAvailable->prevAvailable = page->prevAvailable;
+}
+
+static Page* newPage(int classIndex, size_t slotSize) {
+    size_t size = HEAP_PAGE_SIZE;
+    if(classIndex == HEAP_LARGE_CLASS) {
+        size = (SLOTS_OFFSET + slotSize + HEAP_PAGE_SIZE - 1) & ~(size_t)(HEAP_PAGE_SIZE - 1);
+    }
+
+    Page* page = (Page*)aligned_alloc(HEAP_PAGE_SIZE, size);
+    if(page == NULL) outOfMemoryError(false);
+
+    page->sizeClass = classIndex;
+    page->slotSize = slotSize;
+    page->size = size;
+    page->slots = (char*)page + SLOTS_OFFSET;
+    page->slotCount = classIndex == HEAP_LARGE_CLASS ? 1 : (int)((size - SLOTS_OFFSET) / slotSize);
+    page->freshCount = page->slotCount;
+    page->liveCount = 0;
+    page->freeList = NULL;
+    page->needsSweep = false;
+    page->isEvacuating = false;
+    memset(page->allocated, 0, sizeof(page->allocated));
+    memset(page->marked, 0, sizeof(page->marked));
+    POISON(page->slots, (size_t)page->slotCount * slotSize);
+
+    SizeClass* sizeClass = &vm.sizeClasses[classIndex];
+    page->prev = NULL;
+    page->next = sizeClass->pages;
+    if(sizeClass->pages != NULL) sizeClass->pages->prev = page;
+    sizeClass->pages = page;
+
+    page->isAvailable = false;
+    if(classIndex != HEAP_LARGE_CLASS) makeAvailable(sizeClass, page);
+    return page;
+}
+
+void releasePage(Page* page) {
+    SizeClass* sizeClass = &vm.sizeClasses[page->sizeClass];
+    if(page->isAvailable) makeUnavailable(sizeClass, page);
+
+    if(page->prev != NULL) {
+        page->prev->next = page->next;
+    } else {
+        sizeClass->pages = page->next;
+    }
+    if(page->next != NULL) page->next->prev = page->prev;
+
+    // the lazy sweep may be about to visit this page
+    if(vm.sweepPage == page) vm.sweepPage = page->next;
+
+    free(page);
+}
+
+void retirePage(Page* page) {
+    // allocation no longer uses the page, though its objects stay
+    if(page->isAvailable) makeUnavailable(&vm.sizeClasses[page->sizeClass], page);
+}
+
+void* heapAllocate(size_t size) {
+    size_t slotSize = heapSlotSize(size);
+    int classIndex = slotSize > HEAP_SMALL_MAX ? HEAP_LARGE_CLASS : (int)(slotSize / HEAP_GRANULE) - 1;
+
+    Page* page;
+    if(classIndex == HEAP_LARGE_CLASS) {
+        page = newPage(classIndex, slotSize);
+    } else {
+        page = vm.sizeClasses[classIndex].available;
+        if(page == NULL) page = newPage(classIndex, slotSize);
+    }
+
+    void* slot;
+    if(page->freeList != NULL) {
+        FreeSlot* freeSlot = page->freeList;
+        UNPOISON(freeSlot, slotSize);
+        page->freeList = freeSlot->next;
+        slot = freeSlot;
+    } else {
+        // fresh slots are handed out in address order
+        slot = pageSlot(page, page->slotCount - page->freshCount--);
+        UNPOISON(slot, slotSize);
+    }
+
+    // the mark bit is left alone: it is already clear, and a concurrent
+    // marker may be updating its neighbours
+    int granule = granuleOf(slot);
+    page->allocated[granule / 64] |= (uint64_t)1 << (granule % 64);
+    page->liveCount++;
+
+    if(page->isAvailable && page->freeList == NULL && page->freshCount == 0) {
+        makeUnavailable(&vm.sizeClasses[classIndex], page);
+    }
+    return slot;
+}
+
+size_t heapFree(void* object) {
+    Page* page = pageOf(object);
+    size_t slotSize = page->slotSize;
+
+    if(page->sizeClass == HEAP_LARGE_CLASS) {
+        releasePage(page);
+        return slotSize;
+    }
+
+    int granule = granuleOf(object);
+    page->allocated[granule / 64] &= ~((uint64_t)1 << (granule % 64));
+    page->liveCount--;
+
+    FreeSlot* freeSlot = (FreeSlot*)object;
+    freeSlot->next = page->freeList;
+    page->freeList = freeSlot;
+    POISON(object, slotSize);
+
+    // empty pages are given back by the major sweep, not here, so a page
+    // that empties and refills between collections stays put
+    if(!page->isAvailable) makeAvailable(&vm.sizeClasses[page->sizeClass], page);
+    return slotSize;
+}
@@ -0,0 +1,110 @@
+#ifndef clox_heap_h
+#define clox_heap_h
+
+#include "common.h"
+
+// Objects live in fixed-size slots carved out of aligned pages, with one
+// size class per granule up to HEAP_SMALL_MAX bytes. Masking an object's
+// address finds its page, and the collector finds every object by walking
+// the pages of each class instead of following links stored in the
+// objects themselves. Anything bigger gets a page of its own in the large
+// class. Variable-sized buffers (string characters, arrays, table
+// entries) are not objects and still come from reallocate().
+//
+// Per-object GC state that changes every collection is kept off the
+// objects: each page has an allocation bitmap and a mark bitmap with one
+// bit per granule, indexed by the object's first granule. Marking only
+// writes the page header, and a swept page clears its marks in one go.
+
+#define HEAP_PAGE_SIZE (64 * 1024)
+#define HEAP_GRANULE 8
+#define HEAP_SMALL_MAX 256
+#define HEAP_LARGE_CLASS (HEAP_SMALL_MAX / HEAP_GRANULE)
+#define HEAP_CLASS_COUNT (HEAP_LARGE_CLASS + 1)
+#define HEAP_BITMAP_WORDS (HEAP_PAGE_SIZE / HEAP_GRANULE / 64)
+
+typedef struct FreeSlot {
+    struct FreeSlot* next;
+} FreeSlot;
+
+typedef struct Page {
+    // every page of the class, for walking the heap
+    struct Page* prev;
+    struct Page* next;
+    // pages of the class with a free slot, where allocation looks
+    struct Page* prevAvailable;
+    struct Page* nextAvailable;
+    bool isAvailable;
+
+    bool needsSweep; // may hold old objects the current major cycle has not swept
+    bool isEvacuating; // being emptied by compaction; live slots hold forwarding pointers
+    int sizeClass;
+    int slotCount;
+    int freshCount; // slots at the end never handed out
+    int liveCount;
+    size_t slotSize;
+    size_t size; // bytes reserved, including this header
+    FreeSlot* freeList;
+    char* slots;
+    uint64_t allocated[HEAP_BITMAP_WORDS];
+    uint64_t marked[HEAP_BITMAP_WORDS]; // always clear for a free slot
+} Page;
+
+typedef struct {
+    Page* pages;
+    Page* available;
+} SizeClass;
+
+static inline size_t heapSlotSize(size_t size) {
+    return (size + HEAP_GRANULE - 1) & ~(size_t)(HEAP_GRANULE - 1);
+}
+
+static inline Page* pageOf(const void* object) {
+    // a large object starts within the first page-sized block of its
+    // allocation, so the mask works for both kinds
+    return (Page*)((uintptr_t)object & ~(uintptr_t)(HEAP_PAGE_SIZE - 1));
+}
+
+static inline void* pageSlot(Page* page, int index) {
+    return page->slots + (size_t)index * page->slotSize;
+}
+
+static inline int granuleOf(const void* object) {
+    return (int)(((uintptr_t)object & (HEAP_PAGE_SIZE - 1)) / HEAP_GRANULE);
+}
+
+static inline void* pageGranule(Page* page, int granule) {
+    return (char*)page + (size_t)granule * HEAP_GRANULE;
+}
+
+static inline bool isMarked(const void* object) {
+    // parallel markers may be setting other bits of the word
+    int granule = granuleOf(object);
+    uint64_t word = __atomic_load_n(&pageOf(object)->marked[granule / 64], __ATOMIC_RELAXED);
+    return (word >> (granule % 64)) & 1;
+}
+
+// sets the mark bit atomically and reports whether this call set it
+static inline bool tryMark(const void* object) {
+    int granule = granuleOf(object);
+    uint64_t bit = (uint64_t)1 << (granule % 64);
+    return (__atomic_fetch_or(&pageOf(object)->marked[granule / 64], bit, __ATOMIC_RELAXED) & bit) == 0;
+}
+
+static inline void setMarked(const void* object) {
+    int granule = granuleOf(object);
+    pageOf(object)->marked[granule / 64] |= (uint64_t)1 << (granule % 64);
+}
+
+static inline void clearMarked(const void* object) {
+    int granule = granuleOf(object);
+    pageOf(object)->marked[granule / 64] &= ~((uint64_t)1 << (granule % 64));
+}
+
+void* heapAllocate(size_t size);
+// returns the slot size, for the allocation count
+size_t heapFree(void* object);
+void releasePage(Page* page);
+void retirePage(Page* page);
+
+#endif
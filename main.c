@@ -5,6 +5,9 @@
 #include "common.h"
 #include "chunk.h"
 #include "debug.h"
+#include "memory.h"
+#include "profile.h"
+#include "sampler.h"
 #include "vm.h"
 
 static char* readFile(const char* path) {
@@ -51,29 +54,176 @@ static void repl() {
     }
 }
 
-static void runFile(const char* path) {
+static int runFile(const char* path) {
     char* source = readFile(path);
     InterpretResult result = interpret(source);
     free(source);
 
-    if(result == INTERPRET_COMPILE_ERROR) exit(65);
-    if(result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if(result == INTERPRET_COMPILE_ERROR) return 65;
+    if(result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: clox [--print-code] [--trace] [--stress-gc] [--gc-log] [--profile-ops json-path]\n"
+                    "            [--gc-pause microseconds] [--gc-concurrent] [--gc-compact] [--gc-threads n]\n"
+                    "            [--gc-grow-factor x] [--gc-initial-heap bytes] [--gc-min-heap bytes]\n"
+                    "            [--gc-max-heap bytes] [--gc-stats] [--sample-profile folded-path]\n"
+                    "            [--sample-hz n] [path]\n"
+                    "Sizes take a k, m or g suffix. CLOX_GC_GROW_FACTOR, CLOX_GC_INITIAL_HEAP,\n"
+                    "CLOX_GC_MIN_HEAP and CLOX_GC_MAX_HEAP set the same as the matching flags.\n");
+    exit(64);
+}
+
+static bool parseSize(const char* text, size_t* size) {
+    if(*text < '0' || *text > '9') return false;
+
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    int shift = 0;
+    switch(*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+    }
+    if(*end != '\0' || value > (SIZE_MAX >> shift)) return false;
+
+    *size = (size_t)value << shift;
+    return true;
+}
+
+static bool parseGrowFactor(const char* text, double* factor) {
+    char* end;
+    double value = strtod(text, &end);
+    if(end == text || *end != '\0' || !(value >= 1 && value <= 1000)) return false;
+
+    *factor = value;
+    return true;
+}
+
+static void sizeFromEnvironment(const char* name, size_t* size) {
+    const char* value = getenv(name);
+    if(value != NULL && !parseSize(value, size)) {
+        fprintf(stderr, "Invalid %s \"%s\".\n", name, value);
+        exit(64);
+    }
+}
+
+static void readEnvironment() {
+    // the flags are parsed afterwards, so they win
+    const char* value = getenv("CLOX_GC_GROW_FACTOR");
+    if(value != NULL && !parseGrowFactor(value, &vm.gcGrowFactor)) {
+        fprintf(stderr, "Invalid CLOX_GC_GROW_FACTOR \"%s\".\n", value);
+        exit(64);
+    }
+    sizeFromEnvironment("CLOX_GC_INITIAL_HEAP", &vm.nextGCAt);
+    sizeFromEnvironment("CLOX_GC_MIN_HEAP", &vm.gcMinHeap);
+    sizeFromEnvironment("CLOX_GC_MAX_HEAP", &vm.gcMaxHeap);
 }
 
 int main(int argc, const char* argv[]) {
     initVM();
+    readEnvironment();
+
+    const char* path = NULL;
+    bool gcStats = false;
+    const char* profilePath = NULL;
+    const char* samplePath = NULL;
+    long sampleHz = 1000;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--print-code") == 0) {
+            vm.printCode = true;
+        } else if(strcmp(argv[i], "--trace") == 0) {
+            vm.traceExecution = true;
+        } else if(strcmp(argv[i], "--stress-gc") == 0) {
+            vm.stressGC = true;
+        } else if(strcmp(argv[i], "--gc-log") == 0) {
+            vm.gcLog = true;
+        } else if(strcmp(argv[i], "--profile-ops") == 0 && i + 1 < argc) {
+            // report opcode and call counts on stderr at exit, and write
+            // them to the file as JSON
+            vm.profileOps = true;
+            profilePath = argv[++i];
+        } else if(strcmp(argv[i], "--gc-pause") == 0 && i + 1 < argc) {
+            // collect the old generation incrementally in steps of about
+            // this long instead of stopping the world
+            char* end;
+            long micros = strtol(argv[++i], &end, 10);
+            if(*end != '\0' || micros < 0) usage();
+            vm.gcIncremental = true;
+            vm.gcPauseBudget = (uint64_t)micros * 1000;
+        } else if(strcmp(argv[i], "--gc-concurrent") == 0) {
+            // mark the old generation on a helper thread
+            vm.gcIncremental = true;
+            vm.gcConcurrent = true;
+        } else if(strcmp(argv[i], "--gc-threads") == 0 && i + 1 < argc) {
+            // share the mark of full collections between this many threads
+            char* end;
+            long threads = strtol(argv[++i], &end, 10);
+            if(*end != '\0' || threads < 1 || threads > 64) usage();
+            vm.gcThreads = (int)threads;
+        } else if(strcmp(argv[i], "--gc-compact") == 0) {
+            // move objects out of sparse pages after major collections
+            vm.gcCompact = true;
+        } else if(strcmp(argv[i], "--gc-grow-factor") == 0 && i + 1 < argc) {
+            // how much the heap may grow before the next major collection
+            if(!parseGrowFactor(argv[++i], &vm.gcGrowFactor)) usage();
+        } else if(strcmp(argv[i], "--gc-initial-heap") == 0 && i + 1 < argc) {
+            // heap size that triggers the first major collection
+            if(!parseSize(argv[++i], &vm.nextGCAt)) usage();
+        } else if(strcmp(argv[i], "--gc-min-heap") == 0 && i + 1 < argc) {
+            // no major collection is triggered below this size
+            if(!parseSize(argv[++i], &vm.gcMinHeap)) usage();
+        } else if(strcmp(argv[i], "--gc-max-heap") == 0 && i + 1 < argc) {
+            // hard limit on the heap; going over it is a runtime error
+            if(!parseSize(argv[++i], &vm.gcMaxHeap)) usage();
+        } else if(strcmp(argv[i], "--gc-stats") == 0) {
+            // report collector telemetry on stderr at exit
+            gcStats = true;
+        } else if(strcmp(argv[i], "--sample-profile") == 0 && i + 1 < argc) {
+            // sample the call stack on a wall-clock timer and write the
+            // stacks to the file in the folded format flamegraphs use
+            samplePath = argv[++i];
+        } else if(strcmp(argv[i], "--sample-hz") == 0 && i + 1 < argc) {
+            // samples per second
+            char* end;
+            sampleHz = strtol(argv[++i], &end, 10);
+            if(*end != '\0' || sampleHz < 1 || sampleHz > 100000) usage();
+        } else if(argv[i][0] == '-' || path != NULL) {
+            usage();
+        } else {
+            path = argv[i];
+        }
+    }
 
-    if(argc == 1) {
+    if(vm.nextGCAt < vm.gcMinHeap) vm.nextGCAt = vm.gcMinHeap;
+
+    if(samplePath != NULL && !startSampler((int)sampleHz)) {
+        fprintf(stderr, "Could not start the sampler.\n");
+        exit(71);
+    }
+
+    int status = 0;
+    if(path == NULL) {
         repl();
-    } else if(argc == 2) {
-        runFile(argv[1]);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        status = runFile(path);
     }
 
-
+    if(samplePath != NULL && !stopSampler(samplePath)) {
+        fprintf(stderr, "Could not write samples to \"%s\".\n", samplePath);
+        if(status == 0) status = 74;
+    }
+    if(gcStats) printGCStats();
+    if(profilePath != NULL) {
+        printOpProfile(stderr);
+        if(!writeOpProfileJson(profilePath)) {
+            fprintf(stderr, "Could not write profile to \"%s\".\n", profilePath);
+            if(status == 0) status = 74;
+        }
+        freeOpProfile();
+    }
     freeVM();
 
-    return 0;
+    return status;
 }
@@ -1,116 +1,278 @@
+#include <sched.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #include "memory.h"
 #include "vm.h"
 #include "compiler.h"
 #include "table.h"
+#include "sampler.h"
 
-#ifdef DEBUG_GC_LOG
-#include <stdio.h>
 #include "debug.h"
-#endif
 
-#define GC_HEAP_GROW_FACTOR 2
+// young allocation between minor collections; small enough that the
+// nursery is still cache-warm when it is traced
+#define GC_NURSERY_SIZE (256 * 1024)
+// allocation between incremental steps of a major collection
+#define GC_STEP_SIZE (64 * 1024)
+// objects handled between clock checks within an incremental step; one
+// at a time under --stress-gc
+#define GC_SLICE_WORK 256
+// objects the concurrent marker traces per hold of the heap lock
+#define GC_MARKER_BATCH 64
+// initial size of each parallel marking thread's deque
+#define GC_DEQUE_SIZE 256
+// with --gc-compact, a major collection asks for a compaction when it
+// would give back at least this many pages
+#define GC_COMPACT_MIN_PAGES 16
+// object slots may go this far past the heap limit. Constructors allocate
+// an object's buffers before its slot, so it is the buffer that hits the
+// limit, and an error never strands one whose object was not made
+#define GC_OBJECT_SLACK (64 * 1024)
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
-    vm.bytesAllocated += newSize - oldSize;
+static void startCycle();
+static void incrementalStep();
+static void finishCycle();
+static void fullCollection();
+static void lazySweep();
+static uint64_t nanoTime();
+static void recordPause(PauseStats* stats, uint64_t nanos);
+static void joinMarker();
 
-    if(newSize > oldSize) {
-#ifdef DEBUG_STRESS_GC
-        collectGarbage();
-#endif
-        if(vm.bytesAllocated > vm.nextGCAt) {
+static void logObject(const char* action, Obj* object) {
+    // printing a rope flattens it, which allocates; the concurrent marker
+    // must not do that
+    printf("%p %s ", (void*)object, action);
+    if(object->type == OBJ_STRING && ((ObjString*)object)->chars == NULL) {
+        printf("<rope>");
+    } else {
+        printValue(OBJ_VAL(object));
+    }
+    printf("\n");
+}
+
+static void maybeCollect() {
+    // dead old objects from the last major collection are freed a slice at
+    // a time as the mutator allocates, rather than inside its pause
+    if(vm.gcPhase == GC_SWEEP) lazySweep();
+
+    if(vm.stressGC) {
+        // mostly minor collections, to exercise the write barriers
+        if(vm.gcPhase == GC_MARK) {
+            incrementalStep();
+        } else if(vm.gcPhase == GC_IDLE && (vm.minorCollections + vm.majorCollections) % 16 == 15) {
+            if(vm.gcIncremental) {
+                startCycle();
+            } else {
+                collectGarbage();
+            }
+        } else {
+            collectYoung();
+        }
+    }
+    if(vm.gcPhase == GC_MARK) {
+        if(vm.gcDebt > GC_STEP_SIZE) incrementalStep();
+    } else if(vm.gcPhase == GC_IDLE && vm.bytesAllocated > vm.nextGCAt) {
+        if(vm.gcIncremental) {
+            startCycle();
+        } else {
             collectGarbage();
         }
     }
 
+    // minor collections wait while a major cycle is marking
+    if(vm.gcPhase != GC_MARK && vm.youngBytes > GC_NURSERY_SIZE) {
+        collectYoung();
+    }
+}
+
+static void checkHeapLimit(size_t size, size_t limit) {
+    if(vm.bytesAllocated + size <= limit) return;
+
+    // a last-ditch full collection, unless the caller is in the middle of
+    // a mutation, where collections are not allowed
+    if(vm.mutationDepth == 0) {
+        uint64_t start = nanoTime();
+        fullCollection();
+        finishCycle();
+        recordPause(&vm.majorPauses, nanoTime() - start);
+    }
+    if(vm.bytesAllocated + size > limit) outOfMemoryError(true);
+}
+
+// for code making several allocations that must not fail partway, since
+// the earlier ones would be lost: checks they all fit under the limit
+void reserveHeap(size_t size) {
+    if(vm.gcMaxHeap != 0 && !vm.gcRunning) checkHeapLimit(size, vm.gcMaxHeap);
+}
+
+static void countAllocation(size_t oldSize, size_t newSize, size_t slack) {
+    // the collector's own allocations may go over the limit
+    if(vm.gcMaxHeap != 0 && newSize > oldSize && !vm.gcRunning) {
+        checkHeapLimit(newSize - oldSize, vm.gcMaxHeap + slack);
+    }
+
+    vm.bytesAllocated += newSize - oldSize;
+    if(vm.bytesAllocated > vm.peakBytes) vm.peakBytes = vm.bytesAllocated;
+
+    if(newSize > oldSize) {
+        vm.youngBytes += newSize - oldSize;
+        vm.gcDebt += newSize - oldSize;
+
+        // the collector may allocate itself (resizing the intern table)
+        if(!vm.gcRunning && vm.mutationDepth == 0) maybeCollect();
+    }
+}
+
+void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+    countAllocation(oldSize, newSize, 0);
+
     if(newSize == 0) {
         free(pointer);
         return NULL;
     }
 
     void* ptr = realloc(pointer, newSize);
-    if(ptr == NULL) exit(1);
+    if(ptr == NULL) {
+        vm.bytesAllocated -= newSize - oldSize;
+        outOfMemoryError(false);
+    }
     return ptr;
 }
 
+Obj* allocateObjectSlot(size_t size) {
+    // count the whole slot, so rounding up to the size class is not hidden
+    countAllocation(0, heapSlotSize(size), GC_OBJECT_SLACK);
+    Obj* object = (Obj*)heapAllocate(size);
+
+    if(vm.youngCapacity < vm.youngCount + 1) {
+        vm.youngCapacity = GROW_CAPACITY(vm.youngCapacity);
+        vm.youngObjects = (Obj**)realloc(vm.youngObjects, sizeof(Obj*) * vm.youngCapacity);
+        if(vm.youngObjects == NULL) exit(1);
+    }
+    vm.youngObjects[vm.youngCount++] = object;
+    return object;
+}
+
 static void freeObject(Obj* object) {
 
-#ifdef DEBUG_GC_LOG
-    printf("%p free type %d\n", (void*)object, object->type);
-#endif
+    if(vm.gcLog) printf("%p free type %d\n", (void*)object, object->type);
 
-    switch(object->type) {
-        case OBJ_BOUND_METHOD: {
-                                   FREE(ObjBoundMethod, object);
-                                   break;
-                               }
-        case OBJ_INSTANCE: {
-                               ObjInstance* instance = (ObjInstance*)object;
-                               freeTable(&instance->fields);
-                               FREE(ObjInstance, object);
-                               break;
-                           }
-        case OBJ_CLASS: {
-                            ObjClass* klass = (ObjClass*)object;
-                            freeTable(&klass->methods);
-                            FREE(ObjClass, object);
-                            break;
-                        }
-        case OBJ_UPVALUE: {
-                              FREE(ObjUpvalue, object);
-                              break;
-                          }
+    size_t before = vm.bytesAllocated;
+
+    switch((ObjType)object->type) {
+        case OBJ_MAP:
+            freeValueTable(&((ObjMap*)object)->table);
+            break;
+        case OBJ_LIST:
+            freeValueArray(&((ObjList*)object)->items);
+            break;
+        case OBJ_FLOAT_ARRAY: {
+            ObjFloatArray* array = (ObjFloatArray*)object;
+            FREE_ARRAY(double, array->values, array->count);
+            break;
+        }
+        case OBJ_INSTANCE:
+            freeTable(&((ObjInstance*)object)->fields);
+            break;
+        case OBJ_CLASS:
+            freeTable(&((ObjClass*)object)->methods);
+            break;
         case OBJ_CLOSURE: {
-                              ObjClosure* closure = (ObjClosure*)object;
-                              FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-                              FREE(ObjClosure, object);
-                              break;
-                          }
-        case OBJ_NATIVE: {
-                             FREE(ObjNative, object);
-                             break;
-                         }
-        case OBJ_FUNCTION: {
-                               ObjFunction* function = (ObjFunction*)object;
-                               freeChunk(&function->chunk);
-                               FREE(ObjFunction, object);
-                               break;
+            ObjClosure* closure = (ObjClosure*)object;
+            FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
+            break;
         }
+        case OBJ_FUNCTION:
+            freeChunk(&((ObjFunction*)object)->chunk);
+            break;
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
-            FREE(ObjString, object);
+            if(string->chars != NULL && string->owner == NULL) {
+                FREE_ARRAY(char, string->chars, string->length + 1);
+            }
             break;
         }
+        case OBJ_BOUND_METHOD:
+        case OBJ_UPVALUE:
+        case OBJ_NATIVE:
+            // nothing outside the slot
+            break;
+    }
+
+    vm.bytesAllocated -= heapFree(object);
+    vm.bytesFreed += before - vm.bytesAllocated;
+    vm.objectsFreed++;
+}
+
+// calls visit on every object of the page that is not marked; visit may
+// free the object it is given
+static void forEachUnmarked(Page* page, void (*visit)(Obj* object)) {
+    for(int word = 0; word < HEAP_BITMAP_WORDS; word++) {
+        uint64_t bits = page->allocated[word] & ~page->marked[word];
+        while(bits != 0) {
+            int granule = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            visit((Obj*)pageGranule(page, granule));
+        }
     }
 }
 
 void freeObjects() {
-    Obj* object = vm.objects; 
-    while(object != NULL) {
-        Obj* next = object->next;
-        freeObject(object);
-        object = next;
+    if(vm.markerActive) joinMarker();
+
+    for(int i = 0; i < HEAP_CLASS_COUNT; i++) {
+        while(vm.sizeClasses[i].pages != NULL) {
+            Page* page = vm.sizeClasses[i].pages;
+            if(page->sizeClass == HEAP_LARGE_CLASS) {
+                // freeing a large object releases its page
+                freeObject((Obj*)pageSlot(page, 0));
+            } else {
+                memset(page->marked, 0, sizeof(page->marked));
+                forEachUnmarked(page, freeObject);
+                releasePage(page);
+            }
+        }
     }
 
+    free(vm.youngObjects);
     free(vm.grayStack);
+    free(vm.remembered);
 }
 
+static void pushGray(Obj* object);
+
+typedef struct MarkWorker MarkWorker;
+static __thread MarkWorker* markWorker; // set while a thread takes part in a parallel mark
+static void workerPush(MarkWorker* worker, Obj* object);
+
 void markObject(Obj* object) {
     if(object == NULL) return;
-    if(object->isMarked) return;
+    if(isMarked(object)) return;
+    // old objects are assumed live by a minor collection
+    if(vm.gcMinor && object->isOld) return;
 
-#ifdef DEBUG_GC_LOG
-    printf("%p mark ", (void*)object);
-    printValue(OBJ_VAL(object));
-    printf("\n");
-#endif
+    if(vm.gcLog) logObject("mark", object);
+
+    if(markWorker != NULL) {
+        // another thread may reach the object at the same time; only the
+        // one that sets the bit traces it
+        if(tryMark(object)) workerPush(markWorker, object);
+        return;
+    }
 
     // single entrypoint for marking
-    object->isMarked = true;
+    setMarked(object);
+    pushGray(object);
+}
 
+static void pushGray(Obj* object) {
     if(vm.grayCapacity < vm.grayCount + 1) {
         vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
         vm.grayStack = (Obj**)realloc(vm.grayStack, sizeof(Obj*) * vm.grayCapacity);
@@ -124,6 +286,25 @@ void markValue(Value value) {
     if(IS_OBJ(value)) markObject(AS_OBJ(value));
 }
 
+void rememberObject(Obj* object) {
+    object->isRemembered = true;
+
+    if(vm.rememberedCapacity < vm.rememberedCount + 1) {
+        vm.rememberedCapacity = GROW_CAPACITY(vm.rememberedCapacity);
+        vm.remembered = (Obj**)realloc(vm.remembered, sizeof(Obj*) * vm.rememberedCapacity);
+        if(vm.remembered == NULL) exit(1);
+    }
+
+    vm.remembered[vm.rememberedCount++] = object;
+}
+
+static void forgetRemembered() {
+    for(int i = 0; i < vm.rememberedCount; i++) {
+        vm.remembered[i]->isRemembered = false;
+    }
+    vm.rememberedCount = 0;
+}
+
 static void markRoots() {
 
     // 1. Mark vm stack values
@@ -142,8 +323,12 @@ static void markRoots() {
     }
 
 
-    // 2. Mark vm.globals table 
-    markTable(&vm.globals);
+    // 2. Mark vm globals
+    for(int i = 0; i < vm.globalCapacity; i++) {
+        if(vm.globalNames[i] == NULL) continue;
+        markObject((Obj*)vm.globalNames[i]);
+        markValue(vm.globalValues[i]);
+    }
 
     // 5. Mark compiler function 
     markCompilerRoots();
@@ -158,13 +343,15 @@ static void markValueArray(ValueArray* varray) {
 }
 
 static void blackenObject(Obj* object) {
-#ifdef DEBUG_GC_LOG
-    printf("%p blacken ", (void*)object);
-    printValue(OBJ_VAL(object));
-    printf("\n");
-#endif
+    if(vm.gcLog) logObject("blacken", object);
 
-    switch(object->type) {
+    switch((ObjType)object->type) {
+        case OBJ_MAP:
+            markValueTable(&((ObjMap*)object)->table);
+            break;
+        case OBJ_LIST:
+            markValueArray(&((ObjList*)object)->items);
+            break;
         case OBJ_BOUND_METHOD: {
             ObjBoundMethod* boundMethod = (ObjBoundMethod*)object;
             markValue(boundMethod->receiver);
@@ -202,8 +389,15 @@ static void blackenObject(Obj* object) {
             break;
 
         }
+        case OBJ_STRING: {
+            ObjString* string = (ObjString*)object;
+            markObject((Obj*)string->left);
+            markObject((Obj*)string->right);
+            markObject((Obj*)string->owner);
+            break;
+        }
         case OBJ_NATIVE:
-        case OBJ_STRING:
+        case OBJ_FLOAT_ARRAY:
             // there isn't any external ref
             break;
     }
@@ -216,52 +410,829 @@ static void traceReferences() {
     }
 }
 
-static void sweep() {
-    Obj* prev = NULL;
-    Obj* current = vm.objects;
-    while(current != NULL) {
-        if(current->isMarked) {
-            current->isMarked = false;
-            prev = current;
-            current = current->next;
-        } else {
-            Obj* unreached = current;
-            current = current->next;
+// Parallel marking. The mark of a stop-the-world major collection is
+// shared between vm.gcThreads threads, the main one included. Each has a
+// Chase-Lev deque of gray objects: the owner pushes and takes at the
+// bottom without locking, and a thread that runs dry steals from the top
+// of another's. Marking ends once every thread is idle, which can only
+// happen when all deques are empty, as threads only push to their own.
 
-            if(prev != NULL) {
-                prev->next = current;
-            } else {
-                vm.objects = current;
-            }
+typedef struct MarkBuffer {
+    struct MarkBuffer* previous; // outgrown, but a thief may still read it
+    int64_t capacity;
+    Obj* items[];
+} MarkBuffer;
+
+struct MarkWorker {
+    int64_t top;
+    int64_t bottom;
+    MarkBuffer* buffer;
+    int index;
+    pthread_t thread;
+};
+
+static MarkWorker* markWorkers;
+static int markWorkerCount;
+static int activeMarkers;
 
-            freeObject(unreached);
+static MarkBuffer* newMarkBuffer(int64_t capacity) {
+    MarkBuffer* buffer = (MarkBuffer*)malloc(sizeof(MarkBuffer) + sizeof(Obj*) * capacity);
+    if(buffer == NULL) exit(1);
+    buffer->previous = NULL;
+    buffer->capacity = capacity;
+    return buffer;
+}
+
+static void workerPush(MarkWorker* worker, Obj* object) {
+    int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+    MarkBuffer* buffer = worker->buffer;
+
+    if(bottom - top >= buffer->capacity) {
+        MarkBuffer* grown = newMarkBuffer(buffer->capacity * 2);
+        for(int64_t i = top; i < bottom; i++) {
+            grown->items[i % grown->capacity] =
+                __atomic_load_n(&buffer->items[i % buffer->capacity], __ATOMIC_RELAXED);
         }
+        grown->previous = buffer;
+        __atomic_store_n(&worker->buffer, grown, __ATOMIC_RELEASE);
+        buffer = grown;
     }
+
+    __atomic_store_n(&buffer->items[bottom % buffer->capacity], object, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELEASE);
 }
 
-void collectGarbage() {
-#ifdef DEBUG_GC_LOG
-    printf("-- gc begin \n");
+static Obj* workerTake(MarkWorker* worker) {
+    int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) - 1;
+    MarkBuffer* buffer = worker->buffer;
+    __atomic_store_n(&worker->bottom, bottom, __ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&worker->top, __ATOMIC_SEQ_CST);
+
+    if(top > bottom) {
+        __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    Obj* object = __atomic_load_n(&buffer->items[bottom % buffer->capacity], __ATOMIC_RELAXED);
+    if(top == bottom) {
+        // the last one: a thief may be taking it from the other end
+        if(!__atomic_compare_exchange_n(&worker->top, &top, top + 1, false,
+                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            object = NULL;
+        }
+        __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return object;
+}
+
+static Obj* workerSteal(MarkWorker* victim) {
+    int64_t top = __atomic_load_n(&victim->top, __ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&victim->bottom, __ATOMIC_SEQ_CST);
+    if(top >= bottom) return NULL;
+
+    MarkBuffer* buffer = __atomic_load_n(&victim->buffer, __ATOMIC_ACQUIRE);
+    Obj* object = __atomic_load_n(&buffer->items[top % buffer->capacity], __ATOMIC_RELAXED);
+    if(!__atomic_compare_exchange_n(&victim->top, &top, top + 1, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return object;
+}
+
+static Obj* stealWork(MarkWorker* worker) {
+    for(int i = 1; i < markWorkerCount; i++) {
+        Obj* object = workerSteal(&markWorkers[(worker->index + i) % markWorkerCount]);
+        if(object != NULL) return object;
+    }
+    return NULL;
+}
+
+static bool workVisible() {
+    for(int i = 0; i < markWorkerCount; i++) {
+        MarkWorker* worker = &markWorkers[i];
+        if(__atomic_load_n(&worker->top, __ATOMIC_SEQ_CST) <
+                __atomic_load_n(&worker->bottom, __ATOMIC_SEQ_CST)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void* markWorkerMain(void* argument) {
+    MarkWorker* worker = (MarkWorker*)argument;
+    markWorker = worker;
+
+    for(;;) {
+        Obj* object = workerTake(worker);
+        if(object == NULL) object = stealWork(worker);
+        if(object != NULL) {
+            blackenObject(object);
+            continue;
+        }
+
+        // out of work: wait until there is some to steal or all are idle
+        __atomic_sub_fetch(&activeMarkers, 1, __ATOMIC_SEQ_CST);
+        while(__atomic_load_n(&activeMarkers, __ATOMIC_SEQ_CST) > 0 && !workVisible()) {
+            sched_yield();
+        }
+        if(__atomic_load_n(&activeMarkers, __ATOMIC_SEQ_CST) == 0) break;
+        __atomic_add_fetch(&activeMarkers, 1, __ATOMIC_SEQ_CST);
+    }
+
+    markWorker = NULL;
+    return NULL;
+}
+
+static void traceParallel() {
+    markWorkerCount = vm.gcThreads;
+    markWorkers = (MarkWorker*)malloc(sizeof(MarkWorker) * markWorkerCount);
+    if(markWorkers == NULL) exit(1);
+
+    for(int i = 0; i < markWorkerCount; i++) {
+        markWorkers[i].top = 0;
+        markWorkers[i].bottom = 0;
+        markWorkers[i].buffer = newMarkBuffer(GC_DEQUE_SIZE);
+        markWorkers[i].index = i;
+    }
+
+    // deal out what the roots grayed
+    for(int i = 0; i < vm.grayCount; i++) {
+        workerPush(&markWorkers[i % markWorkerCount], vm.grayStack[i]);
+    }
+    vm.grayCount = 0;
+
+    activeMarkers = markWorkerCount;
+    int started = 1;
+    for(int i = 1; i < markWorkerCount; i++) {
+        if(!startUnsampledThread(&markWorkers[i].thread, markWorkerMain, &markWorkers[i])) {
+            // whatever it was dealt gets stolen by the others
+            __atomic_sub_fetch(&activeMarkers, markWorkerCount - i, __ATOMIC_SEQ_CST);
+            break;
+        }
+        started++;
+    }
+
+    markWorkerMain(&markWorkers[0]);
+    for(int i = 1; i < started; i++) {
+        pthread_join(markWorkers[i].thread, NULL);
+    }
+
+    for(int i = 0; i < markWorkerCount; i++) {
+        MarkBuffer* buffer = markWorkers[i].buffer;
+        while(buffer != NULL) {
+            MarkBuffer* previous = buffer->previous;
+            free(buffer);
+            buffer = previous;
+        }
+    }
+    free(markWorkers);
+    markWorkers = NULL;
+}
+
+static uint64_t nanoTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void recordPause(PauseStats* stats, uint64_t nanos) {
+    stats->count++;
+    stats->totalNanos += nanos;
+    if(nanos > stats->maxNanos) stats->maxNanos = nanos;
+
+    uint64_t micros = nanos / 1000;
+    int bucket = micros == 0 ? 0 : 64 - __builtin_clzll(micros);
+    if(bucket >= GC_PAUSE_BUCKETS) bucket = GC_PAUSE_BUCKETS - 1;
+    stats->buckets[bucket]++;
+}
+
+static void sweepYoung() {
+    // survivors are promoted where they are, so the young set is empty
+    // after every collection
+    for(int i = 0; i < vm.youngCount; i++) {
+        Obj* object = vm.youngObjects[i];
+        if(isMarked(object)) {
+            object->isOld = true;
+            // a page the lazy sweep has yet to reach clears the mark itself,
+            // and would free the object if it were cleared now
+            if(!pageOf(object)->needsSweep) clearMarked(object);
+        } else {
+            freeObject(object);
+        }
+    }
+    vm.youngCount = 0;
+}
+
+void collectYoung() {
+    if(vm.gcLog) printf("-- minor gc begin \n");
     size_t beforeGC = vm.bytesAllocated;
-#endif
 
-    // mark and sweep
+    vm.gcRunning = true;
+    vm.gcMinor = true;
+    uint64_t start = nanoTime();
+
     markRoots();
 
+    // every young object an old one points at was stored through a
+    // write barrier, so the remembered set stands in for the old heap
+    for(int i = 0; i < vm.rememberedCount; i++) {
+        blackenObject(vm.remembered[i]);
+    }
+    forgetRemembered();
 
     traceReferences();
 
-    tableRemoveWhite(&vm.strings);
+    tableRemoveWhite(&vm.strings, true);
+
+    sweepYoung();
+
+    tableCompact(&vm.strings);
+
+    vm.gcMinor = false;
+    vm.gcRunning = false;
+    vm.youngBytes = 0;
+    vm.minorCollections++;
+    vm.heapAfterGC = vm.bytesAllocated;
+    recordPause(&vm.minorPauses, nanoTime() - start);
+
+    if(vm.gcLog) {
+        printf("-- minor gc stopped \n");
+        printf(" collected %zu bytes(from %zu to %zu)\n", beforeGC - vm.bytesAllocated, beforeGC, vm.bytesAllocated);
+    }
+}
+
+// Incremental major collection. Marking is split into steps that run as
+// the mutator allocates, each bounded by vm.gcPauseBudget. The barrier
+// keeps the tricolor invariant: a black (marked and traced) object that
+// gets a reference stored into it is remembered, and the next step grays
+// it again. Objects allocated during the cycle start white on the young
+// list, and the final remark finds the live ones from the roots.
+//
+// Every major collection, incremental or not, ends by flagging every page
+// and leaving them to lazySweep(), so freeing garbage never adds to a
+// pause.
+
+static void regrayRemembered() {
+    // white remembered objects are traced when something reaches them
+    for(int i = 0; i < vm.rememberedCount; i++) {
+        Obj* object = vm.remembered[i];
+        object->isRemembered = false;
+        if(isMarked(object)) pushGray(object);
+    }
+    vm.rememberedCount = 0;
+}
+
+static void finishMarking() {
+    // the atomic remark: roots were only scanned when the cycle started
+    markRoots();
+    regrayRemembered();
+    if(vm.gcPhase == GC_IDLE && vm.gcThreads > 1) {
+        // a whole stop-the-world mark, not the tail of an incremental one
+        traceParallel();
+    } else {
+        traceReferences();
+    }
+
+    tableRemoveWhite(&vm.strings, false);
+    tableCompact(&vm.strings);
+
+    for(int i = 0; i < HEAP_CLASS_COUNT; i++) {
+        for(Page* page = vm.sizeClasses[i].pages; page != NULL; page = page->next) {
+            page->needsSweep = true;
+        }
+    }
+    vm.sweepClass = 0;
+    vm.sweepPage = vm.sizeClasses[0].pages;
+
+    // young survivors keep their mark for the sweep to clear
+    sweepYoung();
+    vm.youngBytes = 0;
+
+    vm.gcPhase = GC_SWEEP;
+}
+
+static int reclaimablePages(SizeClass* sizeClass);
+
+static bool heapFragmented() {
+    if(vm.stressGC) return true;
+
+    int pages = 0;
+    for(int i = 0; i < HEAP_LARGE_CLASS; i++) {
+        int reclaimable = reclaimablePages(&vm.sizeClasses[i]);
+        if(reclaimable > 0) pages += reclaimable;
+    }
+    return pages >= GC_COMPACT_MIN_PAGES;
+}
+
+static void finishSweeping() {
+    vm.gcPhase = GC_IDLE;
+    vm.majorCollections++;
+    vm.heapAfterGC = vm.bytesAllocated;
+    vm.nextGCAt = (size_t)(vm.bytesAllocated * vm.gcGrowFactor);
+    if(vm.nextGCAt < vm.gcMinHeap) vm.nextGCAt = vm.gcMinHeap;
+    if(vm.gcCompact && heapFragmented()) vm.compactRequested = true;
+
+    if(vm.gcLog) {
+        printf("-- sweep done | next GC at %zu | collector time: mark %.3f ms, lazy sweep %.3f ms\n",
+                vm.nextGCAt, vm.majorPauses.totalNanos / 1e6, vm.sweepPauses.totalNanos / 1e6);
+    }
+}
+
+static bool markSlice() {
+    regrayRemembered();
+    int sliceWork = vm.stressGC ? 1 : GC_SLICE_WORK;
+    for(int work = 0; work < sliceWork && vm.grayCount > 0; work++) {
+        blackenObject(vm.grayStack[--vm.grayCount]);
+    }
+    return vm.grayCount > 0;
+}
+
+static void sweepObject(Obj* object) {
+    // young objects were allocated after the mark and belong to the next
+    // minor collection
+    if(object->isOld) freeObject(object);
+}
+
+static bool sweepSlice() {
+    // one page at a time
+    while(vm.sweepPage == NULL) {
+        if(++vm.sweepClass == HEAP_CLASS_COUNT) return false;
+        vm.sweepPage = vm.sizeClasses[vm.sweepClass].pages;
+    }
+
+    Page* page = vm.sweepPage;
+    vm.sweepPage = page->next;
+    if(!page->needsSweep) return true;
+
+    // live objects are not touched: they are the marked ones, and their
+    // marks are dropped together afterwards
+    page->needsSweep = false;
+    if(page->sizeClass == HEAP_LARGE_CLASS) {
+        Obj* object = (Obj*)pageSlot(page, 0);
+        if(isMarked(object)) {
+            clearMarked(object);
+        } else {
+            sweepObject(object);
+        }
+    } else {
+        forEachUnmarked(page, sweepObject);
+        memset(page->marked, 0, sizeof(page->marked));
+        if(page->liveCount == 0) releasePage(page);
+    }
+    return true;
+}
+
+static void lazySweep() {
+    vm.gcRunning = true;
+    uint64_t start = nanoTime();
+    bool more = sweepSlice();
+    recordPause(&vm.sweepPauses, nanoTime() - start);
+    if(!more) finishSweeping();
+    vm.gcRunning = false;
+}
+
+static void* markerMain(void* unused) {
+    // Runs the mark phase off the main thread. It only touches the heap
+    // while holding heapLock, and drops it between batches so a waiting
+    // mutation can get in. The remark on the main thread picks up what
+    // was remembered after the marker finished.
+    pthread_mutex_lock(&vm.heapLock);
+    for(;;) {
+        regrayRemembered();
+        if(vm.grayCount == 0) break;
+
+        for(int work = 0; work < GC_MARKER_BATCH && vm.grayCount > 0; work++) {
+            blackenObject(vm.grayStack[--vm.grayCount]);
+        }
+
+        // a plain unlock and relock usually wins the lock straight back
+        if(__atomic_load_n(&vm.heapWaiters, __ATOMIC_RELAXED) > 0) {
+            pthread_mutex_unlock(&vm.heapLock);
+            sched_yield();
+            pthread_mutex_lock(&vm.heapLock);
+        }
+    }
+    vm.markDone = true;
+    pthread_mutex_unlock(&vm.heapLock);
+    return NULL;
+}
+
+void lockHeap() {
+    __atomic_add_fetch(&vm.heapWaiters, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&vm.heapLock);
+    __atomic_sub_fetch(&vm.heapWaiters, 1, __ATOMIC_RELAXED);
+    vm.heapLocked = true;
+}
+
+static bool markerFinished() {
+    pthread_mutex_lock(&vm.heapLock);
+    bool done = vm.markDone;
+    pthread_mutex_unlock(&vm.heapLock);
+    return done;
+}
+
+static void joinMarker() {
+    pthread_join(vm.marker, NULL);
+    vm.markerActive = false;
+}
+
+static void startCycle() {
+    if(vm.gcLog) printf("-- incremental gc begin \n");
+
+    vm.gcRunning = true;
+    uint64_t start = nanoTime();
+    markRoots();
+    recordPause(&vm.majorPauses, nanoTime() - start);
+    vm.gcRunning = false;
+
+    vm.gcPhase = GC_MARK;
+    vm.gcDebt = 0;
+
+    if(vm.gcConcurrent) {
+        // without a thread the cycle just carries on incrementally
+        vm.markDone = false;
+        vm.markerActive = startUnsampledThread(&vm.marker, markerMain, NULL);
+    }
+}
+
+static void incrementalStep() {
+    if(vm.markerActive) {
+        vm.gcDebt = 0;
+        if(!markerFinished()) return;
+        joinMarker();
+    }
+
+    vm.gcRunning = true;
+
+    uint64_t start = nanoTime();
+    uint64_t elapsed;
+    do {
+        if(!markSlice()) finishMarking();
+        elapsed = nanoTime() - start;
+    } while(vm.gcPhase == GC_MARK && elapsed < vm.gcPauseBudget);
+    recordPause(&vm.majorPauses, elapsed);
+
+    vm.gcRunning = false;
+    vm.gcDebt = 0;
+}
+
+// finishCycle() and fullCollection() are parts of a pause; the entry
+// points that stop the mutator time the whole of it, so one stop is one
+// recorded pause however many parts it has
+
+static void finishCycle() {
+    if(vm.markerActive) joinMarker();
+
+    vm.gcRunning = true;
+    while(vm.gcPhase == GC_MARK) {
+        if(!markSlice()) finishMarking();
+    }
+    while(sweepSlice());
+    finishSweeping();
+    vm.gcRunning = false;
+}
+
+static void fullCollection() {
+    // an explicit full collection completes any cycle in progress first
+    if(vm.gcPhase != GC_IDLE) finishCycle();
+
+    if(vm.gcLog) printf("-- gc begin \n");
+    size_t beforeGC = vm.bytesAllocated;
+
+    // mark both generations in one go; the old list is then swept lazily
+    vm.gcRunning = true;
+    finishMarking();
+    vm.gcRunning = false;
+
+    if(vm.gcLog) {
+        printf("-- gc marked \n");
+        printf(" young garbage freed %zu bytes(from %zu to %zu), old pages left to the lazy sweep\n",
+                beforeGC - vm.bytesAllocated, beforeGC, vm.bytesAllocated);
+
+        TableStats stats;
+        tableStats(&vm.strings, &stats);
+        printf(" intern table: %d live, %d tombstones, capacity %d | probe avg %.2f max %d groups\n",
+                stats.count, stats.tombstones, stats.capacity, stats.averageProbe, stats.maxProbe);
+    }
+}
+
+void collectGarbage() {
+    uint64_t start = nanoTime();
+    fullCollection();
+    recordPause(&vm.majorPauses, nanoTime() - start);
+}
+
+// Compaction. After a full collection every object left is live, old and
+// unmarked. In each size class where it frees pages, the pages less than
+// half full are retired from allocation, their objects copied into the remaining pages (or new
+// ones), and a forwarding pointer left behind in each old slot. Then
+// every reference the VM holds is rewritten and the emptied pages are
+// released. Objects move, so this only runs at a safe point in run(),
+// where nothing but the VM's own roots refers to them.
+
+typedef struct {
+    Obj obj;
+    Obj* to;
+} ForwardedObj;
+
+Obj* forwardObject(Obj* object) {
+    if(object == NULL || !pageOf(object)->isEvacuating) return object;
+    return ((ForwardedObj*)object)->to;
+}
+
+Value forwardValue(Value value) {
+    if(!IS_OBJ(value)) return value;
+    return OBJ_VAL(forwardObject(AS_OBJ(value)));
+}
+
+#define FORWARD(type, field) ((field) = (type*)forwardObject((Obj*)(field)))
+
+static void forwardValueArray(ValueArray* array) {
+    for(int i = 0; i < array->count; i++) {
+        array->values[i] = forwardValue(array->values[i]);
+    }
+}
+
+static void forwardFields(Obj* object) {
+    switch((ObjType)object->type) {
+        case OBJ_MAP:
+            forwardValueTable(&((ObjMap*)object)->table);
+            break;
+        case OBJ_LIST:
+            forwardValueArray(&((ObjList*)object)->items);
+            break;
+        case OBJ_BOUND_METHOD: {
+            ObjBoundMethod* bound = (ObjBoundMethod*)object;
+            bound->receiver = forwardValue(bound->receiver);
+            FORWARD(ObjClosure, bound->method);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            FORWARD(ObjClass, instance->klass);
+            forwardTable(&instance->fields);
+            break;
+        }
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)object;
+            FORWARD(ObjString, klass->name);
+            forwardTable(&klass->methods);
+            break;
+        }
+        case OBJ_UPVALUE: {
+            // a closed upvalue's location was fixed when it was copied
+            ObjUpvalue* upvalue = (ObjUpvalue*)object;
+            upvalue->closed = forwardValue(upvalue->closed);
+            FORWARD(ObjUpvalue, upvalue->next);
+            break;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            FORWARD(ObjFunction, closure->function);
+            for(int i = 0; i < closure->upvalueCount; i++) {
+                FORWARD(ObjUpvalue, closure->upvalues[i]);
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            FORWARD(ObjString, function->name);
+            forwardValueArray(&function->chunk.constants);
+            break;
+        }
+        case OBJ_STRING: {
+            // a slice's chars point into its owner's buffer, which stays put
+            ObjString* string = (ObjString*)object;
+            FORWARD(ObjString, string->left);
+            FORWARD(ObjString, string->right);
+            FORWARD(ObjString, string->owner);
+            break;
+        }
+        case OBJ_NATIVE:
+        case OBJ_FLOAT_ARRAY:
+            break;
+    }
+}
+
+static void forwardRoots() {
+    for(Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        *slot = forwardValue(*slot);
+    }
+    for(int i = 0; i < vm.frameCount; i++) {
+        FORWARD(ObjClosure, vm.frames[i].closure);
+    }
+    FORWARD(ObjUpvalue, vm.openUpvalues);
+
+    for(int i = 0; i < vm.globalCapacity; i++) {
+        if(vm.globalNames[i] == NULL) continue;
+        FORWARD(ObjString, vm.globalNames[i]);
+        vm.globalValues[i] = forwardValue(vm.globalValues[i]);
+    }
+
+    forwardTable(&vm.strings);
+    FORWARD(ObjString, vm.initString);
+}
+
+static bool isSparse(Page* page) {
+    // under --stress-gc, move everything that can move, to exercise the
+    // forwarding
+    if(vm.stressGC) return page->liveCount < page->slotCount;
+    return page->liveCount * 2 < page->slotCount;
+}
+
+// how many pages evacuating the sparse pages of a class would give back:
+// their objects fill the other pages' free slots first, then new pages
+static int reclaimablePages(SizeClass* sizeClass) {
+    int sparse = 0;
+    int sparseLive = 0;
+    int freeElsewhere = 0;
+    int slotCount = 1;
+    for(Page* page = sizeClass->pages; page != NULL; page = page->next) {
+        slotCount = page->slotCount;
+        if(isSparse(page)) {
+            sparse++;
+            sparseLive += page->liveCount;
+        } else {
+            freeElsewhere += page->slotCount - page->liveCount;
+        }
+    }
 
-    sweep();
+    int overflow = sparseLive - freeElsewhere;
+    int pagesNeeded = overflow > 0 ? (overflow + slotCount - 1) / slotCount : 0;
+    return sparse - pagesNeeded;
+}
+
+static int retireSparsePages(SizeClass* sizeClass) {
+    if(!vm.stressGC && reclaimablePages(sizeClass) <= 0) return 0;
+
+    int retired = 0;
+    for(Page* page = sizeClass->pages; page != NULL; page = page->next) {
+        if(!isSparse(page)) continue;
+        page->isEvacuating = true;
+        retirePage(page);
+        retired++;
+    }
+    return retired;
+}
 
-    // schedule next GC 
-    vm.nextGCAt = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+static void evacuateObject(Obj* object) {
+    Page* page = pageOf(object);
+    Obj* copy = (Obj*)heapAllocate(page->slotSize);
+    memcpy(copy, object, page->slotSize);
 
-#ifdef DEBUG_GC_LOG
-    printf("-- gc stopped \n");
-    size_t memoryFreed = beforeGC - vm.bytesAllocated;
-    printf(" collected %zu bytes(from %zu to %zu) | next GC at %zu\n", memoryFreed, beforeGC, vm.bytesAllocated, vm.nextGCAt);
+    if(copy->type == OBJ_UPVALUE) {
+        ObjUpvalue* upvalue = (ObjUpvalue*)object;
+        if(upvalue->location == &upvalue->closed) {
+            ((ObjUpvalue*)copy)->location = &((ObjUpvalue*)copy)->closed;
+        }
+    }
+
+    ((ForwardedObj*)object)->to = copy;
+    vm.objectsMoved++;
+}
+
+static void forEachAllocated(Page* page, void (*visit)(Obj* object)) {
+    for(int word = 0; word < HEAP_BITMAP_WORDS; word++) {
+        uint64_t bits = page->allocated[word];
+        while(bits != 0) {
+            int granule = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            visit((Obj*)pageGranule(page, granule));
+        }
+    }
+}
+
+void compactHeap() {
+    uint64_t start = nanoTime();
+
+    // a full collection first, so only live objects are left to move
+    fullCollection();
+    finishCycle();
+    vm.compactRequested = false;
+
+    if(vm.gcLog) printf("-- compaction begin \n");
+    size_t movedBefore = vm.objectsMoved;
+
+    vm.gcRunning = true;
+
+    int retired = 0;
+    for(int i = 0; i < HEAP_LARGE_CLASS; i++) {
+        retired += retireSparsePages(&vm.sizeClasses[i]);
+    }
+
+    if(retired > 0) {
+        // the sampler's handler reads the flag between any two stores, so
+        // it is set before the first object moves and cleared after the
+        // last reference is fixed
+        vm.gcMoving = true;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        // copies land on pages that are not evacuating, new ones included
+        for(int i = 0; i < HEAP_LARGE_CLASS; i++) {
+            for(Page* page = vm.sizeClasses[i].pages; page != NULL; page = page->next) {
+                if(page->isEvacuating) forEachAllocated(page, evacuateObject);
+            }
+        }
+
+        forwardRoots();
+        for(int i = 0; i < HEAP_CLASS_COUNT; i++) {
+            for(Page* page = vm.sizeClasses[i].pages; page != NULL; page = page->next) {
+                if(!page->isEvacuating) forEachAllocated(page, forwardFields);
+            }
+        }
+
+        for(int i = 0; i < HEAP_LARGE_CLASS; i++) {
+            Page* page = vm.sizeClasses[i].pages;
+            while(page != NULL) {
+                Page* next = page->next;
+                if(page->isEvacuating) releasePage(page);
+                page = next;
+            }
+        }
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        vm.gcMoving = false;
+
+#ifdef __GLIBC__
+        // freed pages in the middle of the malloc arena go back too
+        malloc_trim(0);
 #endif
+    }
+
+    recordPause(&vm.majorPauses, nanoTime() - start);
+    vm.gcRunning = false;
+    vm.compactions++;
+
+    if(vm.gcLog) {
+        printf("-- compaction done | %d pages retired, %zu objects moved\n",
+                retired, vm.objectsMoved - movedBefore);
+    }
+}
+
+// Telemetry. The counters are kept up to date as the collector runs; the
+// census is taken on demand by walking the pages.
+
+void heapCensus(HeapCensus* census) {
+    memset(census, 0, sizeof(HeapCensus));
+    for(int i = 0; i < HEAP_CLASS_COUNT; i++) {
+        for(Page* page = vm.sizeClasses[i].pages; page != NULL; page = page->next) {
+            for(int word = 0; word < HEAP_BITMAP_WORDS; word++) {
+                uint64_t bits = page->allocated[word];
+                while(bits != 0) {
+                    int granule = word * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+                    Obj* object = (Obj*)pageGranule(page, granule);
+                    // left for the lazy sweep to free
+                    if(page->needsSweep && object->isOld && !isMarked(object)) continue;
+                    census->objects[object->type]++;
+                    census->bytes[object->type] += page->slotSize;
+                }
+            }
+        }
+    }
+}
+
+static void printPauses(const char* name, PauseStats* stats) {
+    fprintf(stderr, "%-18s pauses %8d, total %10.3f ms, max %8.3f ms\n", name,
+            stats->count, stats->totalNanos / 1e6, stats->maxNanos / 1e6);
 }
 
+void printGCStats() {
+    fprintf(stderr, "-- gc stats --\n");
+    fprintf(stderr, "collections: %d minor, %d major, %d compactions (%zu objects moved)\n",
+            vm.minorCollections, vm.majorCollections, vm.compactions, vm.objectsMoved);
+    printPauses("minor", &vm.minorPauses);
+    printPauses("major", &vm.majorPauses);
+    printPauses("lazy sweep", &vm.sweepPauses);
+    fprintf(stderr, "freed %zu bytes in %zu objects\n", vm.bytesFreed, vm.objectsFreed);
+    fprintf(stderr, "heap %zu bytes, %zu after the last collection, %zu at peak\n",
+            vm.bytesAllocated, vm.heapAfterGC, vm.peakBytes);
+
+    fprintf(stderr, "\npause histogram      minor    major    sweep\n");
+    for(int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        int minor = vm.minorPauses.buckets[i];
+        int major = vm.majorPauses.buckets[i];
+        int sweep = vm.sweepPauses.buckets[i];
+        if(minor + major + sweep == 0) continue;
+
+        char range[32];
+        if(i == GC_PAUSE_BUCKETS - 1) {
+            snprintf(range, sizeof(range), ">= %llu us", 1ull << (i - 1));
+        } else {
+            snprintf(range, sizeof(range), "< %llu us", 1ull << i);
+        }
+        fprintf(stderr, "  %-14s %8d %8d %8d\n", range, minor, major, sweep);
+    }
+
+    HeapCensus census;
+    heapCensus(&census);
+    int objects = 0;
+    size_t bytes = 0;
+    fprintf(stderr, "\nheap census        objects  slot bytes\n");
+    for(int type = 0; type < OBJ_TYPE_COUNT; type++) {
+        if(census.objects[type] == 0) continue;
+        fprintf(stderr, "  %-14s %8d %11zu\n", objTypeName((ObjType)type), census.objects[type], census.bytes[type]);
+        objects += census.objects[type];
+        bytes += census.bytes[type];
+    }
+    fprintf(stderr, "  %-14s %8d %11zu\n", "total", objects, bytes);
+}
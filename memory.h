@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "object.h"
+#include "vm.h"
 
 #define ALLOCATE(type, count) \
     (type*)reallocate(NULL, 0, sizeof(type) * (count))
@@ -18,10 +19,54 @@
 
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+// objects on the heap by type, garbage not yet swept left out; bytes
+// counts the objects' slots, not the buffers they own
+typedef struct {
+    int objects[OBJ_TYPE_COUNT];
+    size_t bytes[OBJ_TYPE_COUNT];
+} HeapCensus;
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+Obj* allocateObjectSlot(size_t size);
+void reserveHeap(size_t size);
 void freeObjects();
 void markObject(Obj* object);
 void markValue(Value value);
+void rememberObject(Obj* object);
+void lockHeap();
+void collectYoung();
 void collectGarbage();
+void compactHeap();
+Obj* forwardObject(Obj* object);
+Value forwardValue(Value value);
+void heapCensus(HeapCensus* census);
+void printGCStats();
+
+// Must follow every store of a reference into an existing object. An old
+// object pointing at young ones is kept in the remembered set so a minor
+// collection finds them without tracing the old generation. While an
+// incremental collection is marking, a marked owner is remembered too so
+// it gets traced again.
+static inline void writeBarrier(Obj* owner) {
+    if(owner->isRemembered) return;
+    if(owner->isOld || isMarked(owner)) rememberObject(owner);
+}
+
+// Changes to an object the marker could be tracing, together with their
+// write barrier, are bracketed by beginMutation() and endMutation(). While
+// a concurrent mark runs this holds the heap lock, so the marker never
+// reads a table or array halfway through being resized. Collections an
+// allocation would trigger inside the bracket are put off until the
+// next allocation outside it.
+static inline void beginMutation() {
+    if(vm.mutationDepth++ == 0 && vm.markerActive) lockHeap();
+}
+
+static inline void endMutation() {
+    if(--vm.mutationDepth == 0 && vm.heapLocked) {
+        vm.heapLocked = false;
+        pthread_mutex_unlock(&vm.heapLock);
+    }
+}
 
 #endif
@@ -0,0 +1,632 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "common.h"
+#include "memory.h"
+#include "native.h"
+#include "object.h"
+#include "vm.h"
+
+#define RETURN(value) do { args[-1] = (value); return true; } while(false)
+
+static bool clockNative(int argCount, Value* args) {
+    RETURN(NUMBER_VAL((double)clock() / CLOCKS_PER_SEC));
+}
+
+static bool checkMap(Value value, const char* native) {
+    if(IS_MAP(value)) return true;
+    runtimeError("%s() expects a map as its first argument.", native);
+    return false;
+}
+
+static bool mapKey(Value* key, bool intern) {
+    // Keys are normalized so the table can compare them by representation.
+    // Lookups only resolve a string to its interned copy; if there is none
+    // the key can't be present and *key is set to nil.
+    if(IS_NIL(*key)) {
+        runtimeError("Map key cannot be nil.");
+        return false;
+    }
+
+    if(IS_NUMBER(*key)) {
+        double number = AS_NUMBER(*key);
+        if(isnan(number)) {
+            runtimeError("Map key cannot be NaN.");
+            return false;
+        }
+        if(number == 0) *key = NUMBER_VAL(0); // -0 and 0 are the same key
+    } else if(IS_STRING(*key)) {
+        ObjString* string = AS_STRING(*key);
+        string = intern ? internString(string) : findInternedString(string);
+        *key = string == NULL ? NIL_VAL : OBJ_VAL(string);
+    }
+
+    return true;
+}
+
+static bool mapNative(int argCount, Value* args) {
+    RETURN(OBJ_VAL(newMap()));
+}
+
+static bool mapGetNative(int argCount, Value* args) {
+    if(!checkMap(args[0], "mapGet")) return false;
+    Value key = args[1];
+    if(!mapKey(&key, false)) return false;
+
+    Value value;
+    if(IS_NIL(key) || !valueTableGet(&AS_MAP(args[0])->table, key, &value)) {
+        RETURN(NIL_VAL);
+    }
+    RETURN(value);
+}
+
+static bool mapHasNative(int argCount, Value* args) {
+    if(!checkMap(args[0], "mapHas")) return false;
+    Value key = args[1];
+    if(!mapKey(&key, false)) return false;
+
+    RETURN(BOOL_VAL(!IS_NIL(key) && valueTableFind(&AS_MAP(args[0])->table, key) != -1));
+}
+
+static bool mapSetNative(int argCount, Value* args) {
+    if(!checkMap(args[0], "mapSet")) return false;
+    if(!mapKey(&args[1], true)) return false;
+
+    reserveValueTable(&AS_MAP(args[0])->table);
+    beginMutation();
+    valueTableSet(&AS_MAP(args[0])->table, args[1], args[2]);
+    writeBarrier(AS_OBJ(args[0]));
+    endMutation();
+    RETURN(args[2]);
+}
+
+static bool mapDeleteNative(int argCount, Value* args) {
+    if(!checkMap(args[0], "mapDelete")) return false;
+    Value key = args[1];
+    if(!mapKey(&key, false)) return false;
+
+    if(IS_NIL(key)) RETURN(BOOL_VAL(false));
+    beginMutation();
+    bool deleted = valueTableDelete(&AS_MAP(args[0])->table, key);
+    endMutation();
+    RETURN(BOOL_VAL(deleted));
+}
+
+static bool mapSizeNative(int argCount, Value* args) {
+    if(!checkMap(args[0], "mapSize")) return false;
+    RETURN(NUMBER_VAL(AS_MAP(args[0])->table.count));
+}
+
+static bool mapNextNative(int argCount, Value* args) {
+    // mapNext(map, nil) returns the first key, mapNext(map, key) the one
+    // after key and nil once every key has been visited
+    if(!checkMap(args[0], "mapNext")) return false;
+    ValueTable* table = &AS_MAP(args[0])->table;
+
+    int index = 0;
+    if(!IS_NIL(args[1])) {
+        Value key = args[1];
+        if(!mapKey(&key, false)) return false;
+
+        int current = IS_NIL(key) ? -1 : valueTableFind(table, key);
+        if(current == -1) {
+            runtimeError("mapNext() key is not in the map.");
+            return false;
+        }
+        index = current + 1;
+    }
+
+    index = valueTableNext(table, index);
+    RETURN(index == -1 ? NIL_VAL : table->entries[index].key);
+}
+
+static bool checkList(Value value, const char* native) {
+    if(IS_LIST(value)) return true;
+    runtimeError("%s() expects a list as its first argument.", native);
+    return false;
+}
+
+static bool appendNative(int argCount, Value* args) {
+    if(!checkList(args[0], "append")) return false;
+    reserveValueArray(&AS_LIST(args[0])->items);
+    beginMutation();
+    writeValueArray(&AS_LIST(args[0])->items, args[1]);
+    writeBarrier(AS_OBJ(args[0]));
+    endMutation();
+    RETURN(args[1]);
+}
+
+static bool popNative(int argCount, Value* args) {
+    if(!checkList(args[0], "pop")) return false;
+    ValueArray* items = &AS_LIST(args[0])->items;
+    if(items->count == 0) {
+        runtimeError("Can't pop from an empty list.");
+        return false;
+    }
+    beginMutation();
+    Value value = items->values[--items->count];
+    endMutation();
+    RETURN(value);
+}
+
+static bool lenNative(int argCount, Value* args) {
+    if(IS_LIST(args[0])) RETURN(NUMBER_VAL(AS_LIST(args[0])->items.count));
+    if(IS_ANY_STRING(args[0])) RETURN(NUMBER_VAL(stringValueLength(args[0])));
+    if(IS_MAP(args[0])) RETURN(NUMBER_VAL(AS_MAP(args[0])->table.count));
+    if(IS_FLOAT_ARRAY(args[0])) RETURN(NUMBER_VAL(AS_FLOAT_ARRAY(args[0])->count));
+
+    runtimeError("len() expects a list, float array, string or map.");
+    return false;
+}
+
+// Bulk kernels over packed doubles. Reductions keep several independent
+// accumulators so the adds don't serialize on one register; the
+// element-wise loops are left simple enough for the compiler to vectorize.
+
+static double sumKernel(const double* values, int count) {
+    int i = 0;
+    double total;
+#ifdef __SSE2__
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    __m128d acc2 = _mm_setzero_pd(), acc3 = _mm_setzero_pd();
+    for(; i + 8 <= count; i += 8) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(values + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(values + i + 2));
+        acc2 = _mm_add_pd(acc2, _mm_loadu_pd(values + i + 4));
+        acc3 = _mm_add_pd(acc3, _mm_loadu_pd(values + i + 6));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(_mm_add_pd(acc0, acc1), _mm_add_pd(acc2, acc3)));
+    total = lanes[0] + lanes[1];
+#else
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for(; i + 4 <= count; i += 4) {
+        s0 += values[i];
+        s1 += values[i + 1];
+        s2 += values[i + 2];
+        s3 += values[i + 3];
+    }
+    total = (s0 + s1) + (s2 + s3);
+#endif
+    for(; i < count; i++) total += values[i];
+    return total;
+}
+
+static double dotKernel(const double* a, const double* b, int count) {
+    int i = 0;
+    double total;
+#ifdef __SSE2__
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    __m128d acc2 = _mm_setzero_pd(), acc3 = _mm_setzero_pd();
+    for(; i + 8 <= count; i += 8) {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+        acc2 = _mm_add_pd(acc2, _mm_mul_pd(_mm_loadu_pd(a + i + 4), _mm_loadu_pd(b + i + 4)));
+        acc3 = _mm_add_pd(acc3, _mm_mul_pd(_mm_loadu_pd(a + i + 6), _mm_loadu_pd(b + i + 6)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(_mm_add_pd(acc0, acc1), _mm_add_pd(acc2, acc3)));
+    total = lanes[0] + lanes[1];
+#else
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for(; i + 4 <= count; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    total = (s0 + s1) + (s2 + s3);
+#endif
+    for(; i < count; i++) total += a[i] * b[i];
+    return total;
+}
+
+static double extremeKernel(const double* values, int count, bool wantMax) {
+    // count must be at least one; each step is "v < m ? v : m", which is
+    // exactly what minpd computes, so both paths agree
+    double result = values[0];
+    int i = 1;
+#ifdef __SSE2__
+    if(count >= 5) {
+        __m128d acc0 = _mm_set1_pd(result), acc1 = acc0;
+        for(; i + 4 <= count; i += 4) {
+            __m128d v0 = _mm_loadu_pd(values + i);
+            __m128d v1 = _mm_loadu_pd(values + i + 2);
+            acc0 = wantMax ? _mm_max_pd(v0, acc0) : _mm_min_pd(v0, acc0);
+            acc1 = wantMax ? _mm_max_pd(v1, acc1) : _mm_min_pd(v1, acc1);
+        }
+        acc0 = wantMax ? _mm_max_pd(acc1, acc0) : _mm_min_pd(acc1, acc0);
+        double lanes[2];
+        _mm_storeu_pd(lanes, acc0);
+        result = lanes[0];
+        if(wantMax ? lanes[1] > result : lanes[1] < result) result = lanes[1];
+    }
+#endif
+    for(; i < count; i++) {
+        double value = values[i];
+        if(wantMax ? value > result : value < result) result = value;
+    }
+    return result;
+}
+
+static void scaleKernel(double* restrict values, int count, double factor) {
+    for(int i = 0; i < count; i++) values[i] *= factor;
+}
+
+static void addKernel(double* restrict a, const double* restrict b, int count) {
+    for(int i = 0; i < count; i++) a[i] += b[i];
+}
+
+static void fillKernel(double* restrict values, int count, double value) {
+    for(int i = 0; i < count; i++) values[i] = value;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    // NaNs sort after every number
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    if(isnan(x) || isnan(y)) return isnan(x) - isnan(y);
+    return (x > y) - (x < y);
+}
+
+static bool checkFloatArray(Value value, const char* native, const char* position) {
+    if(IS_FLOAT_ARRAY(value)) return true;
+    runtimeError("%s() expects a float array as its %s argument.", native, position);
+    return false;
+}
+
+static bool checkNumber(Value value, const char* native, const char* position) {
+    if(IS_NUMBER(value)) return true;
+    runtimeError("%s() expects a number as its %s argument.", native, position);
+    return false;
+}
+
+static bool floatArrayNative(int argCount, Value* args) {
+    // FloatArray(n) is n zeros, FloatArray(list) copies a list of numbers
+    if(IS_LIST(args[0])) {
+        ObjFloatArray* array = newFloatArray(AS_LIST(args[0])->items.count);
+        ValueArray* items = &AS_LIST(args[0])->items;
+        for(int i = 0; i < items->count; i++) {
+            if(!IS_NUMBER(items->values[i])) {
+                runtimeError("FloatArray() list elements must be numbers.");
+                return false;
+            }
+            array->values[i] = AS_NUMBER(items->values[i]);
+        }
+        RETURN(OBJ_VAL(array));
+    }
+
+    if(!IS_NUMBER(args[0])) {
+        runtimeError("FloatArray() expects a length or a list of numbers.");
+        return false;
+    }
+    double length = AS_NUMBER(args[0]);
+    if(!(length >= 0 && length <= INT32_MAX) || length != (int)length) {
+        runtimeError("FloatArray() length must be a non-negative integer.");
+        return false;
+    }
+    RETURN(OBJ_VAL(newFloatArray((int)length)));
+}
+
+static bool floatSumNative(int argCount, Value* args) {
+    if(!checkFloatArray(args[0], "floatSum", "first")) return false;
+    ObjFloatArray* array = AS_FLOAT_ARRAY(args[0]);
+    RETURN(NUMBER_VAL(sumKernel(array->values, array->count)));
+}
+
+static bool floatDotNative(int argCount, Value* args) {
+    if(!checkFloatArray(args[0], "floatDot", "first")) return false;
+    if(!checkFloatArray(args[1], "floatDot", "second")) return false;
+    ObjFloatArray* a = AS_FLOAT_ARRAY(args[0]);
+    ObjFloatArray* b = AS_FLOAT_ARRAY(args[1]);
+    if(a->count != b->count) {
+        runtimeError("floatDot() arrays must have the same length.");
+        return false;
+    }
+    RETURN(NUMBER_VAL(dotKernel(a->values, b->values, a->count)));
+}
+
+static bool extreme(Value* args, const char* native, bool wantMax) {
+    if(!checkFloatArray(args[0], native, "first")) return false;
+    ObjFloatArray* array = AS_FLOAT_ARRAY(args[0]);
+    if(array->count == 0) {
+        runtimeError("%s() of an empty array.", native);
+        return false;
+    }
+    RETURN(NUMBER_VAL(extremeKernel(array->values, array->count, wantMax)));
+}
+
+static bool floatMinNative(int argCount, Value* args) {
+    return extreme(args, "floatMin", false);
+}
+
+static bool floatMaxNative(int argCount, Value* args) {
+    return extreme(args, "floatMax", true);
+}
+
+static bool floatScaleNative(int argCount, Value* args) {
+    if(!checkFloatArray(args[0], "floatScale", "first")) return false;
+    if(!checkNumber(args[1], "floatScale", "second")) return false;
+    ObjFloatArray* array = AS_FLOAT_ARRAY(args[0]);
+    scaleKernel(array->values, array->count, AS_NUMBER(args[1]));
+    RETURN(args[0]);
+}
+
+static bool floatAddNative(int argCount, Value* args) {
+    // adds the second array into the first
+    if(!checkFloatArray(args[0], "floatAdd", "first")) return false;
+    if(!checkFloatArray(args[1], "floatAdd", "second")) return false;
+    ObjFloatArray* a = AS_FLOAT_ARRAY(args[0]);
+    ObjFloatArray* b = AS_FLOAT_ARRAY(args[1]);
+    if(a->count != b->count) {
+        runtimeError("floatAdd() arrays must have the same length.");
+        return false;
+    }
+    if(a == b) {
+        scaleKernel(a->values, a->count, 2);
+    } else {
+        addKernel(a->values, b->values, a->count);
+    }
+    RETURN(args[0]);
+}
+
+static bool floatFillNative(int argCount, Value* args) {
+    if(!checkFloatArray(args[0], "floatFill", "first")) return false;
+    if(!checkNumber(args[1], "floatFill", "second")) return false;
+    ObjFloatArray* array = AS_FLOAT_ARRAY(args[0]);
+    fillKernel(array->values, array->count, AS_NUMBER(args[1]));
+    RETURN(args[0]);
+}
+
+static bool floatSortNative(int argCount, Value* args) {
+    if(!checkFloatArray(args[0], "floatSort", "first")) return false;
+    ObjFloatArray* array = AS_FLOAT_ARRAY(args[0]);
+    if(array->count > 1) {
+        qsort(array->values, array->count, sizeof(double), compareDoubles);
+    }
+    RETURN(args[0]);
+}
+
+static bool checkString(Value value, const char* native, const char* position) {
+    if(IS_ANY_STRING(value)) return true;
+    runtimeError("%s() expects a string as its %s argument.", native, position);
+    return false;
+}
+
+static int findBytes(const char* haystack, int haystackLength,
+                     const char* needle, int needleLength) {
+    // memchr skips ahead to candidate first bytes a vector at a time and
+    // memcmp confirms the rest
+    if(needleLength == 0) return 0;
+
+    const char* start = haystack;
+    const char* last = haystack + haystackLength - needleLength;
+    while(start <= last) {
+        const char* found = memchr(start, needle[0], last - start + 1);
+        if(found == NULL) return -1;
+        if(memcmp(found + 1, needle + 1, needleLength - 1) == 0) {
+            return (int)(found - haystack);
+        }
+        start = found + 1;
+    }
+    return -1;
+}
+
+static bool substringNative(int argCount, Value* args) {
+    // substring(s, start, end) with end exclusive
+    if(!checkString(args[0], "substring", "first")) return false;
+    if(!checkNumber(args[1], "substring", "second")) return false;
+    if(!checkNumber(args[2], "substring", "third")) return false;
+
+    int length = stringValueLength(args[0]);
+    double start = AS_NUMBER(args[1]);
+    double end = AS_NUMBER(args[2]);
+    if(!(start >= 0 && start <= end && end <= length) ||
+            start != (int)start || end != (int)end) {
+        runtimeError("substring() range %g..%g is invalid for length %d.", start, end, length);
+        return false;
+    }
+
+    RETURN(stringSlice(args[0], (int)start, (int)(end - start)));
+}
+
+static bool indexOfNative(int argCount, Value* args) {
+    if(!checkString(args[0], "indexOf", "first")) return false;
+    if(!checkString(args[1], "indexOf", "second")) return false;
+
+    char haystackBuffer[SMALL_STRING_MAX + 1];
+    char needleBuffer[SMALL_STRING_MAX + 1];
+    const char* haystack = stringValueChars(args[0], haystackBuffer);
+    const char* needle = stringValueChars(args[1], needleBuffer);
+
+    RETURN(NUMBER_VAL(findBytes(haystack, stringValueLength(args[0]),
+                                needle, stringValueLength(args[1]))));
+}
+
+static bool startsWithNative(int argCount, Value* args) {
+    if(!checkString(args[0], "startsWith", "first")) return false;
+    if(!checkString(args[1], "startsWith", "second")) return false;
+
+    int length = stringValueLength(args[0]);
+    int prefixLength = stringValueLength(args[1]);
+    if(prefixLength > length) RETURN(BOOL_VAL(false));
+
+    char stringBuffer[SMALL_STRING_MAX + 1];
+    char prefixBuffer[SMALL_STRING_MAX + 1];
+    const char* chars = stringValueChars(args[0], stringBuffer);
+    const char* prefix = stringValueChars(args[1], prefixBuffer);
+    RETURN(BOOL_VAL(memcmp(chars, prefix, prefixLength) == 0));
+}
+
+static bool isTrimmed(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool trimNative(int argCount, Value* args) {
+    if(!checkString(args[0], "trim", "first")) return false;
+
+    char buffer[SMALL_STRING_MAX + 1];
+    const char* chars = stringValueChars(args[0], buffer);
+    int start = 0;
+    int end = stringValueLength(args[0]);
+    while(start < end && isTrimmed(chars[start])) start++;
+    while(end > start && isTrimmed(chars[end - 1])) end--;
+
+    RETURN(stringSlice(args[0], start, end - start));
+}
+
+static bool splitNative(int argCount, Value* args) {
+    // every piece is a slice of the original string
+    if(!checkString(args[0], "split", "first")) return false;
+    if(!checkString(args[1], "split", "second")) return false;
+
+    int length = stringValueLength(args[0]);
+    int separatorLength = stringValueLength(args[1]);
+    if(separatorLength == 0) {
+        runtimeError("split() separator cannot be empty.");
+        return false;
+    }
+
+    ObjList* list = newList();
+    push(OBJ_VAL(list));
+
+    // chars stays valid across allocations: heap string buffers never move
+    // and inline strings live in the local buffers
+    char stringBuffer[SMALL_STRING_MAX + 1];
+    char separatorBuffer[SMALL_STRING_MAX + 1];
+    const char* chars = stringValueChars(args[0], stringBuffer);
+    const char* separator = stringValueChars(args[1], separatorBuffer);
+
+    int start = 0;
+    for(;;) {
+        int found = findBytes(chars + start, length - start, separator, separatorLength);
+        int end = found == -1 ? length : start + found;
+
+        push(stringSlice(args[0], start, end - start));
+        beginMutation();
+        writeValueArray(&list->items, vm.stackTop[-1]);
+        writeBarrier((Obj*)list);
+        endMutation();
+        pop();
+
+        if(found == -1) break;
+        start = end + separatorLength;
+    }
+
+    pop();
+    RETURN(OBJ_VAL(list));
+}
+
+// gcStats() builds its result on the stack: each field's value is pushed
+// above the map it goes in, and setField() stores it under name and pops it
+static void setField(const char* name) {
+    push(copyStringValue(name, (int)strlen(name)));
+    ObjMap* map = AS_MAP(vm.stackTop[-3]);
+    beginMutation();
+    valueTableSet(&map->table, vm.stackTop[-1], vm.stackTop[-2]);
+    writeBarrier((Obj*)map);
+    endMutation();
+    pop();
+    pop();
+}
+
+static void setNumberField(const char* name, double number) {
+    push(NUMBER_VAL(number));
+    setField(name);
+}
+
+static void pushPauses(PauseStats* stats) {
+    push(OBJ_VAL(newMap()));
+    setNumberField("count", stats->count);
+    setNumberField("totalMs", stats->totalNanos / 1e6);
+    setNumberField("maxMs", stats->maxNanos / 1e6);
+
+    ObjList* histogram = newList();
+    push(OBJ_VAL(histogram));
+    for(int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        beginMutation();
+        writeValueArray(&histogram->items, NUMBER_VAL(stats->buckets[i]));
+        writeBarrier((Obj*)histogram);
+        endMutation();
+    }
+    setField("histogram");
+}
+
+static bool gcStatsNative(int argCount, Value* args) {
+    // building the result allocates, and may collect, so everything it
+    // reports is read first
+    double counters[] = {
+        vm.minorCollections, vm.majorCollections, vm.compactions, (double)vm.objectsMoved,
+        (double)vm.bytesFreed, (double)vm.objectsFreed,
+        (double)vm.bytesAllocated, (double)vm.heapAfterGC, (double)vm.peakBytes,
+    };
+    const char* counterNames[] = {
+        "minorCollections", "majorCollections", "compactions", "objectsMoved",
+        "bytesFreed", "objectsFreed",
+        "heapBytes", "heapAfterGC", "peakBytes",
+    };
+    PauseStats pauses[] = {vm.minorPauses, vm.majorPauses, vm.sweepPauses};
+    const char* pauseNames[] = {"minorPauses", "majorPauses", "sweepPauses"};
+    HeapCensus census;
+    heapCensus(&census);
+
+    push(OBJ_VAL(newMap()));
+    for(int i = 0; i < (int)(sizeof(counters) / sizeof(counters[0])); i++) {
+        setNumberField(counterNames[i], counters[i]);
+    }
+    for(int i = 0; i < 3; i++) {
+        pushPauses(&pauses[i]);
+        setField(pauseNames[i]);
+    }
+
+    push(OBJ_VAL(newMap()));
+    for(int type = 0; type < OBJ_TYPE_COUNT; type++) {
+        if(census.objects[type] == 0) continue;
+        push(OBJ_VAL(newMap()));
+        setNumberField("objects", census.objects[type]);
+        setNumberField("bytes", (double)census.bytes[type]);
+        setField(objTypeName((ObjType)type));
+    }
+    setField("census");
+
+    RETURN(pop());
+}
+
+void defineNatives() {
+    defineNative("clock", 0, clockNative);
+    defineNative("gcStats", 0, gcStatsNative);
+
+    defineNative("Map", 0, mapNative);
+    defineNative("mapGet", 2, mapGetNative);
+    defineNative("mapHas", 2, mapHasNative);
+    defineNative("mapSet", 3, mapSetNative);
+    defineNative("mapDelete", 2, mapDeleteNative);
+    defineNative("mapSize", 1, mapSizeNative);
+    defineNative("mapNext", 2, mapNextNative);
+
+    defineNative("append", 2, appendNative);
+    defineNative("pop", 1, popNative);
+    defineNative("len", 1, lenNative);
+
+    defineNative("FloatArray", 1, floatArrayNative);
+    defineNative("floatSum", 1, floatSumNative);
+    defineNative("floatDot", 2, floatDotNative);
+    defineNative("floatMin", 1, floatMinNative);
+    defineNative("floatMax", 1, floatMaxNative);
+    defineNative("floatScale", 2, floatScaleNative);
+    defineNative("floatAdd", 2, floatAddNative);
+    defineNative("floatFill", 2, floatFillNative);
+    defineNative("floatSort", 1, floatSortNative);
+
+    defineNative("substring", 3, substringNative);
+    defineNative("indexOf", 2, indexOfNative);
+    defineNative("startsWith", 2, startsWithNative);
+    defineNative("trim", 1, trimNative);
+    defineNative("split", 2, splitNative);
+}
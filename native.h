@@ -0,0 +1,9 @@
+#ifndef clox_native_h
+#define clox_native_h
+
+#include "common.h"
+#include "value.h"
+
+void defineNatives();
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "hash.h"
 #include "memory.h"
 #include "object.h"
 #include "value.h"
@@ -12,12 +14,11 @@
     (type*)allocateObject(sizeof(type), objType);
 
 static Obj* allocateObject(size_t size, ObjType type) {
-    Obj* obj = (Obj*)reallocate(NULL, 0, size);
+    Obj* obj = allocateObjectSlot(size);
     obj->type = type;
-    obj->isMarked = false;
+    obj->isOld = false;
+    obj->isRemembered = false;
 
-    obj->next = vm.objects;
-    vm.objects = obj;
     vm.objectCount++;
 
     return obj;
@@ -49,6 +50,7 @@ ObjFunction* newFunction() {
     function->arity = 0;
     function->name = NULL;
     function->upvalueCount = 0;
+    function->profileId = -1;
     initChunk(&function->chunk);
     return function;
 }
@@ -74,46 +76,66 @@ ObjClosure* newClosure(ObjFunction* function) {
     return closure;
 }
 
-ObjNative* newNative(NativeFn function) {
+ObjNative* newNative(NativeFn function, int arity) {
     ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
+    native->arity = arity;
     native->function = function;
     return native;
 }
 
-static ObjString* allocateString(char* chars, int length, uint32_t hash) {
+ObjMap* newMap() {
+    ObjMap* map = ALLOCATE_OBJ(ObjMap, OBJ_MAP);
+    initValueTable(&map->table);
+    return map;
+}
+
+ObjList* newList() {
+    ObjList* list = ALLOCATE_OBJ(ObjList, OBJ_LIST);
+    initValueArray(&list->items);
+    return list;
+}
+
+ObjFloatArray* newFloatArray(int count) {
+    // allocate the elements first so a collection can't see a half-built array
+    double* values = ALLOCATE(double, count);
+    for(int i = 0; i < count; i++) values[i] = 0;
+
+    ObjFloatArray* array = ALLOCATE_OBJ(ObjFloatArray, OBJ_FLOAT_ARRAY);
+    array->count = count;
+    array->values = values;
+    return array;
+}
+
+static ObjString* allocateString(char* chars, int length) {
     ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
     string->length = length;
     string->chars = chars;
-    string->hash = hash;
+    string->hash = 0;
+    string->symbol = -1;
+    string->isHashed = false;
+    string->isInterned = false;
+    string->left = NULL;
+    string->right = NULL;
+    string->owner = NULL;
+    return string;
+}
+
+static void internNewString(ObjString* string) {
+    string->isInterned = true;
 
     push(OBJ_VAL(string));
     tableSet(&vm.strings, string, NIL_VAL);
     pop();
-
-    return string;
 }
 
 static uint32_t hashString(const char* key, int length) {
-    uint32_t hash = 2166136261u;
-
-    for(int i = 0; i < length; i++) {
-        hash ^= (uint8_t)key[i]; // need to cast it to uint_8
-        hash *= 16777619;
-    }
-
-    return hash;
+    return hashBytes32(key, (size_t)length, vm.hashSeed);
 }
 
 ObjString* takeString(char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
-    if(interned != NULL) {
-        // also free chars, since we allocated memory for it 
-        FREE_ARRAY(char, chars, length + 1);
-        return interned;
-    }
-
-    return allocateString(chars, length, hash);
+    // strings built at runtime are mostly used once, so hashing and
+    // interning wait until something needs it (see internString)
+    return allocateString(chars, length);
 }
 
 ObjString* copyString(const char* chars, int length) {
@@ -124,7 +146,190 @@ ObjString* copyString(const char* chars, int length) {
     char* heapChars = ALLOCATE(char, length + 1);
     memcpy(heapChars, chars, length); 
     heapChars[length] = '\0';
-    return allocateString(heapChars, length, hash);
+
+    ObjString* string = allocateString(heapChars, length);
+    string->hash = hash;
+    string->isHashed = true;
+    internNewString(string);
+    return string;
+}
+
+ObjString* copySymbol(const char* chars, int length) {
+    // identifiers get a small integer id on top of being interned, so
+    // lookups keyed by name can index an array instead of probing a table
+    ObjString* string = copyString(chars, length);
+    if(string->symbol == -1) {
+        string->symbol = vm.symbolCount++;
+    }
+    return string;
+}
+
+ObjString* newRope(ObjString* left, ObjString* right) {
+    // characters of a rope are unknown until it is flattened
+    ObjString* rope = allocateString(NULL, left->length + right->length);
+    rope->left = left;
+    rope->right = right;
+    return rope;
+}
+
+char* flattenString(ObjString* string) {
+    if(string->chars != NULL) return string->chars;
+
+    // the buffer allocation can trigger a GC, keep the rope reachable
+    push(OBJ_VAL(string));
+    char* chars = ALLOCATE(char, string->length + 1);
+    pop();
+
+    // walk the tree iteratively filling the buffer back to front; ropes
+    // built in a loop are thousands of levels deep
+    int end = string->length;
+    int stackCount = 0;
+    int stackCapacity = 8;
+    ObjString** stack = (ObjString**)malloc(sizeof(ObjString*) * stackCapacity);
+    if(stack == NULL) exit(1);
+    stack[stackCount++] = string;
+
+    while(stackCount > 0) {
+        ObjString* node = stack[--stackCount];
+        if(node->chars != NULL) {
+            end -= node->length;
+            memcpy(chars + end, node->chars, node->length);
+            continue;
+        }
+
+        if(stackCapacity < stackCount + 2) {
+            stackCapacity = GROW_CAPACITY(stackCapacity);
+            stack = (ObjString**)realloc(stack, sizeof(ObjString*) * stackCapacity);
+            if(stack == NULL) exit(1);
+        }
+        stack[stackCount++] = node->left;
+        stack[stackCount++] = node->right;
+    }
+    free(stack);
+
+    chars[string->length] = '\0';
+    beginMutation();
+    string->chars = chars;
+    string->left = NULL;
+    string->right = NULL;
+    endMutation();
+    return chars;
+}
+
+uint32_t stringHash(ObjString* string) {
+    if(!string->isHashed) {
+        flattenString(string);
+        string->hash = hashString(string->chars, string->length);
+        string->isHashed = true;
+    }
+    return string->hash;
+}
+
+ObjString* findInternedString(ObjString* string) {
+    // lookups use this so probing for a missing key doesn't intern it
+    if(string->isInterned) return string;
+
+    uint32_t hash = stringHash(string);
+    return tableFindString(&vm.strings, string->chars, string->length, hash);
+}
+
+ObjString* internString(ObjString* string) {
+    ObjString* interned = findInternedString(string);
+    if(interned != NULL) return interned;
+
+    // interned strings are also names, which get printed as C strings, so
+    // a slice is not terminated enough to be one. The table gets a copy,
+    // which also keeps it from pinning the rest of the owner's buffer
+    if(string->owner != NULL) return copyString(string->chars, string->length);
+
+    internNewString(string);
+    return string;
+}
+
+bool stringsEqual(ObjString* a, ObjString* b) {
+    if(a == b) return true;
+    if(a->isInterned && b->isInterned) return false;
+    if(a->length != b->length) return false;
+    if(a->isHashed && b->isHashed && a->hash != b->hash) return false;
+
+    push(OBJ_VAL(a));
+    push(OBJ_VAL(b));
+    flattenString(a);
+    flattenString(b);
+    pop();
+    pop();
+
+    // a one-off comparison is cheaper than hashing both sides first
+    return memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+// The *StringValue functions work on any string Value. Short strings never
+// get an ObjString: they are packed into the Value itself (see value.h),
+// which keeps a single representation per string so equality stays a
+// bit comparison for them.
+
+Value copyStringValue(const char* chars, int length) {
+    if(FITS_SMALL_STRING(length)) return smallStringVal(chars, length);
+    return OBJ_VAL(copyString(chars, length));
+}
+
+Value takeStringValue(char* chars, int length) {
+    if(FITS_SMALL_STRING(length)) {
+        Value value = smallStringVal(chars, length);
+        FREE_ARRAY(char, chars, length + 1);
+        return value;
+    }
+    return OBJ_VAL(takeString(chars, length));
+}
+
+int stringValueLength(Value value) {
+    if(IS_SMALL_STRING(value)) return smallStringLength(value);
+    return AS_STRING(value)->length;
+}
+
+Value stringSlice(Value string, int start, int length) {
+    // the caller keeps string reachable; results short enough to be inline
+    // are copied, longer ones share the parent's characters
+    if(start == 0 && length == stringValueLength(string)) return string;
+
+    if(IS_SMALL_STRING(string) || FITS_SMALL_STRING(length)) {
+        char buffer[SMALL_STRING_MAX + 1];
+        const char* chars = stringValueChars(string, buffer);
+        return copyStringValue(chars + start, length);
+    }
+
+    ObjString* parent = AS_STRING(string);
+    char* chars = flattenString(parent);
+    ObjString* slice = allocateString(chars + start, length);
+    slice->owner = parent->owner != NULL ? parent->owner : parent;
+    return OBJ_VAL(slice);
+}
+
+const char* stringValueChars(Value value, char* buffer) {
+    // buffer needs room for SMALL_STRING_MAX + 1 bytes; flattening a rope
+    // allocates, so the caller must keep the value reachable
+    if(IS_SMALL_STRING(value)) {
+        smallStringChars(value, buffer);
+        return buffer;
+    }
+    return flattenString(AS_STRING(value));
+}
+
+const char* objTypeName(ObjType type) {
+    switch(type) {
+        case OBJ_CLASS: return "class";
+        case OBJ_INSTANCE: return "instance";
+        case OBJ_STRING: return "string";
+        case OBJ_FUNCTION: return "function";
+        case OBJ_NATIVE: return "native";
+        case OBJ_CLOSURE: return "closure";
+        case OBJ_UPVALUE: return "upvalue";
+        case OBJ_BOUND_METHOD: return "boundMethod";
+        case OBJ_MAP: return "map";
+        case OBJ_LIST: return "list";
+        case OBJ_FLOAT_ARRAY: return "floatArray";
+    }
+    return "unknown";
 }
 
 static void printFunction(ObjFunction* function) {
@@ -135,8 +340,41 @@ static void printFunction(ObjFunction* function) {
     printf("<fn %s>", function->name->chars);
 }
 
+static void printList(ObjList* list) {
+    // a list can contain itself, so stop descending past a fixed depth
+    static int depth = 0;
+    if(depth >= 16) {
+        printf("[...]");
+        return;
+    }
+
+    depth++;
+    printf("[");
+    for(int i = 0; i < list->items.count; i++) {
+        if(i > 0) printf(", ");
+        printValue(list->items.values[i]);
+    }
+    printf("]");
+    depth--;
+}
+
 void printObject(Value value) {
     switch(OBJ_TYPE(value)) {
+        case OBJ_MAP:
+            printf("<map>");
+            break;
+        case OBJ_LIST:
+            printList(AS_LIST(value));
+            break;
+        case OBJ_FLOAT_ARRAY: {
+            ObjFloatArray* array = AS_FLOAT_ARRAY(value);
+            printf("FloatArray[");
+            for(int i = 0; i < array->count; i++) {
+                printf(i > 0 ? ", %g" : "%g", array->values[i]);
+            }
+            printf("]");
+            break;
+        }
         case OBJ_BOUND_METHOD: 
             printFunction(AS_BOUND_METHOD(value)->method->function);
             break;
@@ -159,9 +397,11 @@ void printObject(Value value) {
         case OBJ_FUNCTION:
             printFunction(AS_FUNCTION(value));
             break;
-        case OBJ_STRING: 
-            printf("%s", AS_CSTRING(value));
+        case OBJ_STRING: {
+            ObjString* string = AS_STRING(value);
+            fwrite(flattenString(string), sizeof(char), string->length, stdout);
             break;
+        }
     }
 }
 
@@ -6,21 +6,30 @@
 #include "value.h"
 #include "table.h"
 
-#define OBJ_TYPE(value)     (AS_OBJ(value)->type)
+// concatenations at least this long build a rope instead of copying
+#define ROPE_MIN_LENGTH 32
+
+#define OBJ_TYPE(value)     ((ObjType)AS_OBJ(value)->type)
 #define IS_STRING(value)    isObjType(value, OBJ_STRING)
+#define IS_ANY_STRING(value) (IS_SMALL_STRING(value) || IS_STRING(value))
 #define IS_FUNCTION(value)  isObjType(value, OBJ_FUNCTION)
 #define IS_NATIVE(value)    isObjType(value, OBJ_NATIVE)
 #define IS_CLOSURE(value)   isObjType(value, OBJ_CLOSURE)
 #define IS_CLASS(value)     isObjType(value, OBJ_CLASS)
 #define IS_INSTANCE(value)  isObjType(value, OBJ_INSTANCE)
 #define IS_BOUND_METHOD(value) isObjType(value, OBJ_BOUND_METHOD)
+#define IS_MAP(value)       isObjType(value, OBJ_MAP)
+#define IS_LIST(value)      isObjType(value, OBJ_LIST)
+#define IS_FLOAT_ARRAY(value) isObjType(value, OBJ_FLOAT_ARRAY)
 
+#define AS_MAP(value)       ((ObjMap*)AS_OBJ(value))
+#define AS_LIST(value)      ((ObjList*)AS_OBJ(value))
+#define AS_FLOAT_ARRAY(value) ((ObjFloatArray*)AS_OBJ(value))
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
 #define AS_INSTANCE(value)  ((ObjInstance*)AS_OBJ(value))
 #define AS_CLASS(value)     ((ObjClass*)AS_OBJ(value))
 #define AS_CLOSURE(value)   ((ObjClosure*)AS_OBJ(value))
-#define AS_NATIVE(value) \
-    (((ObjNative*)AS_OBJ(value))->function)
+#define AS_NATIVE(value)    ((ObjNative*)AS_OBJ(value))
 #define AS_FUNCTION(value)  ((ObjFunction*)AS_OBJ(value))
 #define AS_STRING(value)    ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value)   (((ObjString*)AS_OBJ(value))->chars)
@@ -34,12 +43,20 @@ typedef enum {
     OBJ_CLOSURE,
     OBJ_UPVALUE,
     OBJ_BOUND_METHOD,
+    OBJ_MAP,
+    OBJ_LIST,
+    OBJ_FLOAT_ARRAY,
 } ObjType;
 
+#define OBJ_TYPE_COUNT (OBJ_FLOAT_ARRAY + 1)
+
+// Two bytes with byte alignment, so the small fields of each object type
+// pack in right behind it rather than after padding. Mark bits live in
+// the page (see heap.h).
 struct Obj {
-    ObjType type;
-    bool isMarked;
-    struct Obj* next;
+    uint8_t type; // an ObjType
+    bool isOld : 1; // survived a collection, so no longer in vm.youngObjects
+    bool isRemembered : 1; // old object queued in vm.remembered
 };
 
 
@@ -58,9 +75,10 @@ typedef struct {
 typedef struct {
     Obj obj;
     int arity;
+    int upvalueCount;
+    int profileId; // its entry in opProfile, -1 until it runs under --profile-ops
     Chunk chunk;
     ObjString* name;
-    int upvalueCount;
 } ObjFunction;
 
 typedef struct ObjUpvalue {
@@ -72,9 +90,9 @@ typedef struct ObjUpvalue {
 
 typedef struct {
     Obj obj;
+    int upvalueCount;
     ObjFunction* function;
     ObjUpvalue** upvalues;
-    int upvalueCount;
 } ObjClosure;
 
 typedef struct {
@@ -83,18 +101,49 @@ typedef struct {
     ObjClosure* method;
 } ObjBoundMethod;
 
-typedef Value (*NativeFn)(int argCount, Value* args);
+// natives store their result in args[-1], the callee's stack slot, and
+// return false after reporting a runtime error
+typedef bool (*NativeFn)(int argCount, Value* args);
 
 typedef struct {
     Obj obj;
+    int arity; // -1 accepts any number of arguments
     NativeFn function;
 } ObjNative;
 
+typedef struct {
+    Obj obj;
+    ValueTable table;
+} ObjMap;
+
+typedef struct {
+    Obj obj;
+    ValueArray items;
+} ObjList;
+
+// fixed-length packed doubles, so bulk natives can loop over raw memory
+typedef struct {
+    Obj obj;
+    int count;
+    double* values;
+} ObjFloatArray;
+
 struct ObjString{
     Obj obj;
+    bool isHashed; // hash is computed lazily for runtime strings
+    bool isInterned;
     int length;
     uint32_t hash;
-    char* chars;
+    int symbol; // dense id for identifiers, -1 if never used as a name
+    char* chars; // NULL until a rope is flattened; not NUL-terminated in a slice
+
+    // a rope is the lazy concatenation left + right; both are dropped
+    // once the characters have been materialized
+    ObjString* left;
+    ObjString* right;
+
+    // a slice borrows chars from owner's buffer instead of copying them
+    ObjString* owner;
 };
 
 ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method);
@@ -103,9 +152,25 @@ ObjClass* newClass(ObjString* name);
 ObjFunction* newFunction();
 ObjUpvalue* newUpvalue(Value* value);
 ObjClosure* newClosure(ObjFunction* function);
-ObjNative* newNative(NativeFn function);
+ObjNative* newNative(NativeFn function, int arity);
+ObjMap* newMap();
+ObjList* newList();
+ObjFloatArray* newFloatArray(int count);
 ObjString* takeString(char* chars, int length);
 ObjString* copyString(const char* chars, int length);
+ObjString* copySymbol(const char* chars, int length);
+ObjString* newRope(ObjString* left, ObjString* right);
+char* flattenString(ObjString* string);
+uint32_t stringHash(ObjString* string);
+ObjString* findInternedString(ObjString* string);
+ObjString* internString(ObjString* string);
+bool stringsEqual(ObjString* a, ObjString* b);
+Value copyStringValue(const char* chars, int length);
+Value takeStringValue(char* chars, int length);
+int stringValueLength(Value value);
+Value stringSlice(Value string, int start, int length);
+const char* stringValueChars(Value value, char* buffer);
+const char* objTypeName(ObjType type);
 void printObject(Value value);
 
 static inline bool isObjType(Value value, ObjType type) {
@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "debug.h"
+
+// how many opcode pairs and functions the text report lists; the JSON
+// file has all of them
+#define REPORT_PAIRS 20
+#define REPORT_FUNCTIONS 30
+
+OpProfile opProfile;
+
+void addFunctionProfile(ObjFunction* function) {
+    if(opProfile.functionCapacity < opProfile.functionCount + 1) {
+        opProfile.functionCapacity = opProfile.functionCapacity < 8 ? 8 : opProfile.functionCapacity * 2;
+        opProfile.functions = (FunctionProfile*)realloc(opProfile.functions,
+                sizeof(FunctionProfile) * opProfile.functionCapacity);
+        if(opProfile.functions == NULL) exit(1);
+    }
+
+    // the profile is not on the GC heap, and keeps its own copy of the name
+    FunctionProfile* entry = &opProfile.functions[opProfile.functionCount];
+    if(function->name != NULL) {
+        entry->name = strndup(function->name->chars, function->name->length);
+    } else {
+        entry->name = strdup("<script>");
+    }
+    if(entry->name == NULL) exit(1);
+    entry->line = function->chunk.count > 0 ? function->chunk.lines[0] : 0;
+    entry->calls = 0;
+    entry->instructions = 0;
+    function->profileId = opProfile.functionCount++;
+}
+
+typedef struct {
+    int previous;
+    int next;
+    uint64_t count;
+} OpPair;
+
+static int compareOps(const void* a, const void* b) {
+    uint64_t countA = opProfile.ops[*(const int*)a];
+    uint64_t countB = opProfile.ops[*(const int*)b];
+    return countA < countB ? 1 : countA > countB ? -1 : 0;
+}
+
+static int comparePairs(const void* a, const void* b) {
+    uint64_t countA = ((const OpPair*)a)->count;
+    uint64_t countB = ((const OpPair*)b)->count;
+    return countA < countB ? 1 : countA > countB ? -1 : 0;
+}
+
+static int compareFunctions(const void* a, const void* b) {
+    uint64_t countA = opProfile.functions[*(const int*)a].instructions;
+    uint64_t countB = opProfile.functions[*(const int*)b].instructions;
+    return countA < countB ? 1 : countA > countB ? -1 : 0;
+}
+
+// the report and the JSON list everything in descending order of count
+typedef struct {
+    int ops[OP_COUNT];
+    OpPair* pairs;
+    int pairCount;
+    int* functions;
+} SortedProfile;
+
+static void sortProfile(SortedProfile* sorted) {
+    for(int op = 0; op < OP_COUNT; op++) sorted->ops[op] = op;
+    qsort(sorted->ops, OP_COUNT, sizeof(int), compareOps);
+
+    sorted->pairs = (OpPair*)malloc(sizeof(OpPair) * OP_COUNT * OP_COUNT);
+    sorted->functions = (int*)malloc(sizeof(int) * (opProfile.functionCount + 1));
+    if(sorted->pairs == NULL || sorted->functions == NULL) exit(1);
+
+    sorted->pairCount = 0;
+    for(int previous = 0; previous < OP_COUNT; previous++) {
+        for(int next = 0; next < OP_COUNT; next++) {
+            uint64_t count = opProfile.pairs[previous][next];
+            if(count == 0) continue;
+            sorted->pairs[sorted->pairCount++] = (OpPair){previous, next, count};
+        }
+    }
+    qsort(sorted->pairs, sorted->pairCount, sizeof(OpPair), comparePairs);
+
+    for(int i = 0; i < opProfile.functionCount; i++) sorted->functions[i] = i;
+    qsort(sorted->functions, opProfile.functionCount, sizeof(int), compareFunctions);
+}
+
+static void freeSortedProfile(SortedProfile* sorted) {
+    free(sorted->pairs);
+    free(sorted->functions);
+}
+
+static double percent(uint64_t count) {
+    return opProfile.instructions == 0 ? 0 : 100.0 * count / opProfile.instructions;
+}
+
+void printOpProfile(FILE* out) {
+    SortedProfile sorted;
+    sortProfile(&sorted);
+
+    fprintf(out, "-- opcode profile: %llu instructions --\n", (unsigned long long)opProfile.instructions);
+    fprintf(out, "%-20s %14s %7s\n", "opcode", "count", "%");
+    for(int i = 0; i < OP_COUNT; i++) {
+        uint64_t count = opProfile.ops[sorted.ops[i]];
+        if(count == 0) break;
+        fprintf(out, "%-20s %14llu %7.2f\n", opcodeName(sorted.ops[i]), (unsigned long long)count, percent(count));
+    }
+
+    fprintf(out, "\n%-40s %14s %7s\n", "opcode pair", "count", "%");
+    for(int i = 0; i < sorted.pairCount && i < REPORT_PAIRS; i++) {
+        OpPair* pair = &sorted.pairs[i];
+        char name[64];
+        snprintf(name, sizeof(name), "%s %s", opcodeName(pair->previous), opcodeName(pair->next));
+        fprintf(out, "%-40s %14llu %7.2f\n", name, (unsigned long long)pair->count, percent(pair->count));
+    }
+
+    fprintf(out, "\n%-32s %12s %14s %7s\n", "function", "calls", "instructions", "%");
+    for(int i = 0; i < opProfile.functionCount && i < REPORT_FUNCTIONS; i++) {
+        FunctionProfile* entry = &opProfile.functions[sorted.functions[i]];
+        char name[64];
+        snprintf(name, sizeof(name), "%s (line %d)", entry->name, entry->line);
+        fprintf(out, "%-32s %12llu %14llu %7.2f\n", name, (unsigned long long)entry->calls,
+                (unsigned long long)entry->instructions, percent(entry->instructions));
+    }
+
+    freeSortedProfile(&sorted);
+}
+
+bool writeOpProfileJson(const char* path) {
+    FILE* file = fopen(path, "w");
+    if(file == NULL) return false;
+
+    SortedProfile sorted;
+    sortProfile(&sorted);
+
+    // names are opcodes and Lox identifiers, so nothing needs escaping
+    fprintf(file, "{\n  \"instructions\": %llu,\n", (unsigned long long)opProfile.instructions);
+
+    fprintf(file, "  \"opcodes\": {");
+    const char* separator = "\n";
+    for(int i = 0; i < OP_COUNT; i++) {
+        uint64_t count = opProfile.ops[sorted.ops[i]];
+        if(count == 0) break;
+        fprintf(file, "%s    \"%s\": %llu", separator, opcodeName(sorted.ops[i]), (unsigned long long)count);
+        separator = ",\n";
+    }
+    fprintf(file, "\n  },\n");
+
+    fprintf(file, "  \"pairs\": {");
+    separator = "\n";
+    for(int i = 0; i < sorted.pairCount; i++) {
+        OpPair* pair = &sorted.pairs[i];
+        fprintf(file, "%s    \"%s %s\": %llu", separator, opcodeName(pair->previous),
+                opcodeName(pair->next), (unsigned long long)pair->count);
+        separator = ",\n";
+    }
+    fprintf(file, "\n  },\n");
+
+    fprintf(file, "  \"functions\": [");
+    separator = "\n";
+    for(int i = 0; i < opProfile.functionCount; i++) {
+        FunctionProfile* entry = &opProfile.functions[sorted.functions[i]];
+        fprintf(file, "%s    {\"name\": \"%s\", \"line\": %d, \"calls\": %llu, \"instructions\": %llu}",
+                separator, entry->name, entry->line, (unsigned long long)entry->calls,
+                (unsigned long long)entry->instructions);
+        separator = ",\n";
+    }
+    fprintf(file, "\n  ]\n}\n");
+
+    freeSortedProfile(&sorted);
+    return fclose(file) == 0;
+}
+
+void freeOpProfile() {
+    for(int i = 0; i < opProfile.functionCount; i++) free(opProfile.functions[i].name);
+    free(opProfile.functions);
+    memset(&opProfile, 0, sizeof(OpProfile));
+}
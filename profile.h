@@ -0,0 +1,51 @@
+#ifndef clox_profile_h
+#define clox_profile_h
+
+#include <stdio.h>
+
+#include "common.h"
+#include "chunk.h"
+#include "object.h"
+
+// Counts kept by the instrumented copy of the dispatch loop that runs
+// under --profile-ops (see run() in vm.c). Functions are profiled by
+// entry rather than by object, so the counts outlive a function that is
+// collected and follow one that compaction moves.
+
+typedef struct {
+    char* name;
+    int line;
+    uint64_t calls;
+    uint64_t instructions;
+} FunctionProfile;
+
+typedef struct {
+    uint64_t instructions;
+    uint64_t ops[OP_COUNT];
+    uint64_t pairs[OP_COUNT][OP_COUNT]; // [previous][next]
+    FunctionProfile* functions;
+    int functionCount;
+    int functionCapacity;
+} OpProfile;
+
+extern OpProfile opProfile;
+
+void addFunctionProfile(ObjFunction* function);
+void printOpProfile(FILE* out);
+bool writeOpProfileJson(const char* path);
+void freeOpProfile();
+
+// previous is the opcode executed before this one, or -1; called is set
+// on the first instruction of a call
+static inline void profileInstruction(ObjFunction* function, uint8_t instruction, int previous, bool called) {
+    opProfile.instructions++;
+    opProfile.ops[instruction]++;
+    if(previous >= 0) opProfile.pairs[previous][instruction]++;
+
+    if(function->profileId < 0) addFunctionProfile(function);
+    FunctionProfile* entry = &opProfile.functions[function->profileId];
+    entry->instructions++;
+    if(called) entry->calls++;
+}
+
+#endif
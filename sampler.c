@@ -0,0 +1,249 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sampler.h"
+#include "hash.h"
+#include "vm.h"
+
+// The handler is the only producer and the writer thread the only
+// consumer, so the ring needs no lock: each side owns one index. The
+// handler copies names into the sample instead of keeping the function,
+// which may be collected or moved before the writer gets to it.
+
+#define SAMPLE_RING_SIZE 1024 // a power of two
+#define SAMPLE_NAME_MAX 32
+#define SAMPLE_DRAIN_NANOS (10 * 1000 * 1000)
+#define SAMPLE_STACK_MAX (FRAMES_MAX * (SAMPLE_NAME_MAX + 12) + 8)
+
+typedef struct {
+    char name[SAMPLE_NAME_MAX];
+    int line;
+} SampleFrame;
+
+typedef struct {
+    int depth;
+    bool inGC;
+    SampleFrame frames[FRAMES_MAX];
+} Sample;
+
+// a folded stack and how many samples had it
+typedef struct {
+    char* stack;
+    uint64_t hash;
+    uint64_t count;
+} StackCount;
+
+static Sample ring[SAMPLE_RING_SIZE];
+static uint32_t ringHead; // next slot the handler fills
+static uint32_t ringTail; // next slot the writer reads
+static uint64_t samplesDropped; // the ring was full
+static __thread bool isSampledThread;
+
+static timer_t timer;
+static pthread_t writer;
+static bool writerStopping;
+static struct sigaction previousAction;
+
+// only the writer thread touches these until it is joined
+static StackCount* stacks;
+static int stackCount;
+static int stackCapacity;
+static uint64_t samplesTaken;
+
+static void takeSample(int signal) {
+    (void)signal;
+    // frames are read as the interrupted code left them; call() fills a
+    // frame in before counting it
+    if(!isSampledThread || vm.frameCount == 0) return;
+
+    uint32_t head = ringHead;
+    if(head - __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE) == SAMPLE_RING_SIZE) {
+        samplesDropped++;
+        return;
+    }
+
+    Sample* sample = &ring[head & (SAMPLE_RING_SIZE - 1)];
+    sample->inGC = vm.gcRunning;
+    // while compaction is forwarding them, frames may point at moved objects
+    sample->depth = vm.gcMoving ? 0 : vm.frameCount;
+    for(int i = 0; i < sample->depth; i++) {
+        CallFrame* frame = &vm.frames[i];
+        ObjFunction* function = frame->closure->function;
+        SampleFrame* sampleFrame = &sample->frames[i];
+
+        if(function->name == NULL) {
+            memcpy(sampleFrame->name, "<script>", sizeof("<script>"));
+        } else {
+            int length = function->name->length;
+            if(length > SAMPLE_NAME_MAX - 1) length = SAMPLE_NAME_MAX - 1;
+            memcpy(sampleFrame->name, function->name->chars, length);
+            sampleFrame->name[length] = '\0';
+        }
+
+        // the ip has already moved past the instruction being run
+        ptrdiff_t offset = frame->ip - function->chunk.code - 1;
+        if(offset < 0) offset = 0;
+        sampleFrame->line = offset < function->chunk.count ? function->chunk.lines[offset] : 0;
+    }
+
+    __atomic_store_n(&ringHead, head + 1, __ATOMIC_RELEASE);
+}
+
+static void countStack(const char* stack, size_t length) {
+    if(stackCapacity < (stackCount + 1) * 2) {
+        // open addressing, kept at most half full
+        int oldCapacity = stackCapacity;
+        StackCount* oldStacks = stacks;
+        stackCapacity = oldCapacity < 64 ? 64 : oldCapacity * 2;
+        stacks = (StackCount*)calloc(stackCapacity, sizeof(StackCount));
+        if(stacks == NULL) exit(1);
+
+        for(int i = 0; i < oldCapacity; i++) {
+            if(oldStacks[i].stack == NULL) continue;
+            int index = (int)(oldStacks[i].hash & (stackCapacity - 1));
+            while(stacks[index].stack != NULL) index = (index + 1) & (stackCapacity - 1);
+            stacks[index] = oldStacks[i];
+        }
+        free(oldStacks);
+    }
+
+    uint64_t hash = hashBytes(stack, length, 0);
+    int index = (int)(hash & (stackCapacity - 1));
+    while(stacks[index].stack != NULL) {
+        if(stacks[index].hash == hash && strcmp(stacks[index].stack, stack) == 0) {
+            stacks[index].count++;
+            return;
+        }
+        index = (index + 1) & (stackCapacity - 1);
+    }
+
+    stacks[index].stack = strdup(stack);
+    if(stacks[index].stack == NULL) exit(1);
+    stacks[index].hash = hash;
+    stacks[index].count = 1;
+    stackCount++;
+}
+
+static void foldSample(Sample* sample) {
+    // outermost frame first, as the folded format expects
+    char stack[SAMPLE_STACK_MAX];
+    size_t length = 0;
+    for(int i = 0; i < sample->depth; i++) {
+        length += snprintf(stack + length, sizeof(stack) - length, "%s%s:%d",
+                i == 0 ? "" : ";", sample->frames[i].name, sample->frames[i].line);
+    }
+    if(sample->inGC) {
+        length += snprintf(stack + length, sizeof(stack) - length, "%s[gc]", length == 0 ? "" : ";");
+    }
+    if(length == 0) return;
+
+    countStack(stack, length);
+    samplesTaken++;
+}
+
+static void drainRing() {
+    uint32_t tail = ringTail;
+    uint32_t head = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+    while(tail != head) {
+        foldSample(&ring[tail & (SAMPLE_RING_SIZE - 1)]);
+        tail++;
+        __atomic_store_n(&ringTail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+static void* writerMain(void* unused) {
+    struct timespec pause = {0, SAMPLE_DRAIN_NANOS};
+    while(!__atomic_load_n(&writerStopping, __ATOMIC_ACQUIRE)) {
+        drainRing();
+        nanosleep(&pause, NULL);
+    }
+    drainRing();
+    return NULL;
+}
+
+bool startUnsampledThread(pthread_t* thread, void* (*start)(void*), void* argument) {
+    // the new thread inherits the blocked signal
+    sigset_t signals;
+    sigset_t previousMask;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &signals, &previousMask);
+    bool started = pthread_create(thread, NULL, start, argument) == 0;
+    pthread_sigmask(SIG_SETMASK, &previousMask, NULL);
+    return started;
+}
+
+bool startSampler(int hz) {
+    isSampledThread = true;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = takeSample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if(sigaction(SIGPROF, &action, &previousAction) != 0) return false;
+
+    if(!startUnsampledThread(&writer, writerMain, NULL)) return false;
+
+    // a wall-clock timer, so time spent waiting is sampled too
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+    if(timer_create(CLOCK_MONOTONIC, &event, &timer) != 0) return false;
+
+    long interval = 1000000000L / hz;
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = interval / 1000000000L;
+    spec.it_interval.tv_nsec = interval % 1000000000L;
+    spec.it_value = spec.it_interval;
+    return timer_settime(timer, 0, &spec, NULL) == 0;
+}
+
+static int compareStacks(const void* a, const void* b) {
+    return strcmp(((const StackCount*)a)->stack, ((const StackCount*)b)->stack);
+}
+
+bool stopSampler(const char* path) {
+    timer_delete(timer);
+    // ignoring the signal drops one already pending, which the default
+    // action would otherwise turn into an exit
+    struct sigaction ignore;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPROF, &ignore, NULL);
+    sigaction(SIGPROF, &previousAction, NULL);
+    isSampledThread = false;
+
+    __atomic_store_n(&writerStopping, true, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+
+    // sorted, so two profiles of the same program diff cleanly
+    int count = 0;
+    for(int i = 0; i < stackCapacity; i++) {
+        if(stacks[i].stack != NULL) stacks[count++] = stacks[i];
+    }
+    qsort(stacks, count, sizeof(StackCount), compareStacks);
+
+    FILE* file = fopen(path, "w");
+    if(file != NULL) {
+        for(int i = 0; i < count; i++) {
+            fprintf(file, "%s %llu\n", stacks[i].stack, (unsigned long long)stacks[i].count);
+        }
+        if(fclose(file) != 0) file = NULL;
+    }
+
+    fprintf(stderr, "-- sampler: %llu samples (%llu dropped), %d stacks --\n",
+            (unsigned long long)samplesTaken, (unsigned long long)samplesDropped, count);
+
+    for(int i = 0; i < count; i++) free(stacks[i].stack);
+    free(stacks);
+    stacks = NULL;
+    stackCount = 0;
+    stackCapacity = 0;
+    return file != NULL;
+}
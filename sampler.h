@@ -0,0 +1,21 @@
+#ifndef clox_sampler_h
+#define clox_sampler_h
+
+#include <pthread.h>
+
+#include "common.h"
+
+// A wall-clock sampling profiler. A timer raises SIGPROF on the main
+// thread, and the handler copies the call stack (function names and
+// current lines) into a ring buffer. A writer thread drains the ring and
+// counts identical stacks, which are written out in the folded format
+// flamegraph.pl and similar tools read.
+
+bool startSampler(int hz);
+// stops sampling and writes the folded stacks to path
+bool stopSampler(const char* path);
+// pthread_create for threads the VM starts, with the signal blocked
+// from the start so it always lands on the main thread
+bool startUnsampledThread(pthread_t* thread, void* (*start)(void*), void* argument);
+
+#endif
@@ -1,163 +1,573 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "table.h"
+#include "hash.h"
 #include "object.h"
 #include "value.h"
 #include "memory.h"
+#include "vm.h"
+
+#define TABLE_MAX_LOAD 0.875
+#define TABLE_MAX_TOMBSTONES 0.125
+#define TABLE_MIN_LOAD 0.25
+#define GROUP_SIZE 16
+
+// control bytes; a full slot holds H2 of its key, which has the top bit clear
+#define CTRL_EMPTY    ((uint8_t)0x80)
+#define CTRL_DELETED  ((uint8_t)0xfe)
+#define CTRL_SENTINEL ((uint8_t)0xff) // pads tables smaller than a group
+
+#define IS_FULL(ctrl) (((ctrl) & 0x80) == 0)
+
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t)((hash) & 0x7f))
+
+// one bit per slot of a group
+typedef uint32_t GroupMask;
+
+#ifdef __SSE2__
+
+static inline GroupMask matchByte(const uint8_t* group, uint8_t byte) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8((char)byte), ctrl));
+}
+
+static inline GroupMask matchEmptyOrDeleted(const uint8_t* group) {
+    // EMPTY and DELETED are the only control bytes below SENTINEL as int8
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8((char)CTRL_SENTINEL), ctrl));
+}
+
+#else
+
+// portable fallback; simple enough for the compiler to vectorize
+static inline GroupMask matchByte(const uint8_t* group, uint8_t byte) {
+    GroupMask mask = 0;
+    for(int i = 0; i < GROUP_SIZE; i++) {
+        mask |= (GroupMask)(group[i] == byte) << i;
+    }
+    return mask;
+}
+
+static inline GroupMask matchEmptyOrDeleted(const uint8_t* group) {
+    GroupMask mask = 0;
+    for(int i = 0; i < GROUP_SIZE; i++) {
+        mask |= (GroupMask)(group[i] == CTRL_EMPTY || group[i] == CTRL_DELETED) << i;
+    }
+    return mask;
+}
+
+#endif
+
+static inline GroupMask matchEmpty(const uint8_t* group) {
+    return matchByte(group, CTRL_EMPTY);
+}
+
+static inline int lowestSlot(GroupMask mask) {
+    return __builtin_ctz(mask);
+}
+
+static inline int groupCount(int capacity) {
+    return capacity < GROUP_SIZE ? 1 : capacity / GROUP_SIZE;
+}
+
+static inline int controlSize(int capacity) {
+    return capacity < GROUP_SIZE ? GROUP_SIZE : capacity;
+}
+
+// Groups are probed triangularly (g, g+1, g+3, g+6...), which visits every
+// group once when the group count is a power of two. A lookup can stop at
+// the first group with an EMPTY slot since an insert would have used it.
+#define FOR_EACH_PROBE_GROUP(capacity, hash, base) \
+    for(int probe_ = 0, mask_ = groupCount(capacity) - 1, \
+            group_ = (int)(H1(hash) & (uint32_t)mask_), base = group_ * GROUP_SIZE; ; \
+        group_ = (group_ + ++probe_) & mask_, base = group_ * GROUP_SIZE)
+
+// The probing, rebuilding and inserting below is shared by Table and
+// ValueTable, which differ only in their entry type and in how a key is
+// hashed and compared. Entries are passed untyped with their size, and
+// the key functions are constants at every call, so the always_inline
+// helpers compile to the same code a typed copy would.
+
+typedef bool (*KeyMatch)(const void* entry, const void* key);
+typedef uint32_t (*EntryHash)(const void* entry);
+
+static inline void* entryAt(void* entries, size_t entrySize, int index) {
+    return (char*)entries + (size_t)index * entrySize;
+}
+
+static inline __attribute__((always_inline)) int findSlot(const uint8_t* control, int capacity,
+        void* entries, size_t entrySize, uint32_t hash, KeyMatch matches, const void* key) {
+    FOR_EACH_PROBE_GROUP(capacity, hash, base) {
+        const uint8_t* group = &control[base];
+        for(GroupMask match = matchByte(group, H2(hash)); match != 0; match &= match - 1) {
+            int index = base + lowestSlot(match);
+            if(matches(entryAt(entries, entrySize, index), key)) return index;
+        }
+
+        if(matchEmpty(group) != 0) return -1;
+    }
+}
+
+static int findInsertSlot(uint8_t* control, int capacity, uint32_t hash) {
+    FOR_EACH_PROBE_GROUP(capacity, hash, base) {
+        GroupMask free = matchEmptyOrDeleted(&control[base]);
+        if(free != 0) return base + lowestSlot(free);
+    }
+}
+
+static uint8_t* newControl(int capacity) {
+    uint8_t* control = ALLOCATE(uint8_t, controlSize(capacity));
+    memset(control, CTRL_EMPTY, capacity);
+    memset(control + capacity, CTRL_SENTINEL, controlSize(capacity) - capacity);
+    return control;
+}
+
+static void freeControl(uint8_t* control, int capacity) {
+    if(capacity > 0) FREE_ARRAY(uint8_t, control, controlSize(capacity));
+}
+
+static inline __attribute__((always_inline)) void reinsertAll(const uint8_t* oldControl, void* oldEntries,
+        int oldCapacity, uint8_t* control, void* entries, int capacity, size_t entrySize, EntryHash hashOf) {
+    // live entries move to the new arrays; tombstones are dropped
+    for(int i = 0; i < oldCapacity; i++) {
+        if(!IS_FULL(oldControl[i])) continue;
+
+        void* entry = entryAt(oldEntries, entrySize, i);
+        uint32_t hash = hashOf(entry);
+        int index = findInsertSlot(control, capacity, hash);
+        control[index] = H2(hash);
+        memcpy(entryAt(entries, entrySize, index), entry, entrySize);
+    }
+}
+
+// the capacity a table is rebuilt at to take one more key, or -1 if it
+// has room; when tombstones are what filled it, it is rehashed at the
+// same size
+static int insertCapacity(int count, int tombstones, int capacity) {
+    if(count + tombstones + 1 <= capacity * TABLE_MAX_LOAD) return -1;
 
-#define TABLE_MAX_LOAD 0.75
+    if(count + 1 > capacity * TABLE_MAX_LOAD / 2) {
+        capacity = GROW_CAPACITY(capacity);
+    }
+    return capacity;
+}
+
+static int claimSlot(uint8_t* control, int capacity, int* tombstones, uint32_t hash) {
+    // the caller fills in the entry
+    int index = findInsertSlot(control, capacity, hash);
+    if(control[index] == CTRL_DELETED) (*tombstones)--;
+    control[index] = H2(hash);
+    return index;
+}
+
+static bool clearControl(uint8_t* control, int index) {
+    // a group that still has an EMPTY slot never overflowed, so no probe
+    // sequence continues past it and the slot can go straight to EMPTY;
+    // returns whether a tombstone had to be left instead
+    int base = index - index % GROUP_SIZE;
+    if(matchEmpty(&control[base]) != 0) {
+        control[index] = CTRL_EMPTY;
+        return false;
+    }
+
+    control[index] = CTRL_DELETED;
+    return true;
+}
 
 void initTable(Table* table) {
     table->count = 0;
+    table->tombstones = 0;
     table->capacity = 0;
+    table->control = NULL;
     table->entries = NULL;
 }
 
 void freeTable(Table* table) {
+    freeControl(table->control, table->capacity);
     FREE_ARRAY(Entry, table->entries, table->capacity);
     initTable(table);
 }
 
+// keys are interned, so they compare by identity
+static bool entryHasKey(const void* entry, const void* key) {
+    return ((const Entry*)entry)->key == (const ObjString*)key;
+}
 
-static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
-    // get the hash
-    Entry* tombstone = NULL;
-    uint32_t index = key->hash & (capacity-1);
-
-    for(;;) {
-        Entry* entry = &entries[index];
+static uint32_t entryHash(const void* entry) {
+    return ((const Entry*)entry)->key->hash;
+}
 
-        if(entry->key == NULL) {
-            if(IS_NIL(entry->value)) {
-                return tombstone!=NULL ? tombstone : entry; 
-            } else {
-                if(tombstone == NULL) tombstone = entry;
-            }
-        } else if(entry->key == key) {
-            // found the appropriate key
-            return entry;
-        }
+static Entry* findEntry(Table* table, ObjString* key) {
+    if(table->count == 0) return NULL;
 
-        index = (index+1) & (capacity - 1);
-    }
+    int index = findSlot(table->control, table->capacity, table->entries, sizeof(Entry),
+            key->hash, entryHasKey, key);
+    return index == -1 ? NULL : &table->entries[index];
 }
 
 static void adjustCapacity(Table* table, int capacity) {
     // expand and rearrange 
+    reserveHeap(controlSize(capacity) + sizeof(Entry) * capacity);
+    uint8_t* control = newControl(capacity);
     Entry* entries = ALLOCATE(Entry, capacity);
 
-    // populate default val
-    for(int i = 0; i < capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].value = NIL_VAL;
-    }
-
-    // reassign and keep count 
-    table->count = 0;
-
-    for(int i = 0; i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
-        if(entry->key == NULL) continue; // skip empty values
-
-        Entry* dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        table->count++;
-    }
-
+    reinsertAll(table->control, table->entries, table->capacity, control, entries, capacity,
+            sizeof(Entry), entryHash);
 
+    freeControl(table->control, table->capacity);
     FREE_ARRAY(Entry, table->entries, table->capacity);
+    table->control = control;
     table->entries = entries;
     table->capacity = capacity;
+    table->tombstones = 0;
 }
 
 bool tableSet(Table* table, ObjString* key, Value value) {
     // returns true iff new entry was added
-    if(table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
-    } 
-    
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
-    if(isNewKey && IS_NIL(entry->value)) table->count++;
+    Entry* entry = findEntry(table, key);
+    if(entry != NULL) {
+        entry->value = value;
+        return false;
+    }
 
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+    int capacity = insertCapacity(table->count, table->tombstones, table->capacity);
+    if(capacity != -1) adjustCapacity(table, capacity);
+
+    int index = claimSlot(table->control, table->capacity, &table->tombstones, key->hash);
+    table->entries[index].key = key;
+    table->entries[index].value = value;
+    table->count++;
+    return true;
 }
 
 bool tableGet(Table* table, ObjString* key, Value* value) {
     // if found entry with key <key>, set entry's value into <value>
-    if(table->count == 0) return false; // protect against entries being NULL
-
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if(entry->key == NULL) return false;
+    Entry* entry = findEntry(table, key);
+    if(entry == NULL) return false;
 
     // found it
     *value = entry->value;
     return true;
 }
 
-bool tableDelete(Table* table, ObjString* key) {
-    // replace with tombstone instead of actually deleting it
-    // and also do not decrement count
-    if(table->count == 0) return false; 
+static void deleteSlot(Table* table, int index) {
+    if(clearControl(table->control, index)) table->tombstones++;
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if(entry->key == NULL) return false; // key doesnt exist or is already deleted
+    table->entries[index].key = NULL;
+    table->entries[index].value = NIL_VAL;
+    table->count--;
+}
 
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true); 
+bool tableDelete(Table* table, ObjString* key) {
+    Entry* entry = findEntry(table, key);
+    if(entry == NULL) return false; // key doesnt exist or is already deleted
 
+    deleteSlot(table, (int)(entry - table->entries));
     return true;
 }
 
 void tableAddAll(Table* from, Table* to){
     // adds all entries in table <from> into table <to>
     for(int i = 0; i < from->capacity; i++)  {
-        Entry* entry = &from->entries[i];
-        if(entry->key == NULL) continue;
+        if(!IS_FULL(from->control[i])) continue;
 
+        Entry* entry = &from->entries[i];
         tableSet(to, entry->key, entry->value);
     }
 }
 
+// the characters being interned, which have no ObjString yet
+typedef struct {
+    const char* chars;
+    int length;
+    uint32_t hash;
+} StringKey;
+
+static bool entryHasChars(const void* entry, const void* key) {
+    const ObjString* string = ((const Entry*)entry)->key;
+    const StringKey* chars = (const StringKey*)key;
+    return string->length == chars->length &&
+            string->hash == chars->hash &&
+            memcmp(string->chars, chars->chars, chars->length) == 0;
+}
+
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
     if(table->count == 0) return NULL; 
 
-    uint32_t index = hash & (table->capacity - 1);
+    StringKey key = {chars, length, hash};
+    int index = findSlot(table->control, table->capacity, table->entries, sizeof(Entry),
+            hash, entryHasChars, &key);
+    return index == -1 ? NULL : table->entries[index].key;
+}
 
-    for(;;) {
-        Entry* entry = &table->entries[index];
+void tableRemoveWhite(Table* table, bool youngOnly) {
+    // a minor collection never marks old keys, they are live by definition
+    for(int i = 0; i < table->capacity; i++) {
+        if(!IS_FULL(table->control[i])) continue;
+        Obj* key = &table->entries[i].key->obj;
+        if(!isMarked(key) && !(youngOnly && key->isOld)) {
+            deleteSlot(table, i);
+        }
+    }
+}
+
+static void rehashInPlace(Table* table) {
+    // Drops tombstones without allocating, so it is safe mid-collection.
+    // Flip DELETED to EMPTY and FULL to DELETED, then walk the table and
+    // move every DELETED-marked entry to the first free slot of its probe
+    // sequence, swapping when that slot holds another unplaced entry.
+    uint8_t* control = table->control;
+    for(int i = 0; i < table->capacity; i++) {
+        control[i] = IS_FULL(control[i]) ? CTRL_DELETED : CTRL_EMPTY;
+    }
 
-        if(entry->key == NULL) {
-            if(IS_NIL(entry->value)) return NULL;
-        } else if(entry->key->length == length && 
-                entry->key->hash == hash && 
-                memcmp(entry->key->chars, chars, length) == 0){
-            return entry->key;
+    for(int i = 0; i < table->capacity; i++) {
+        if(control[i] != CTRL_DELETED) continue;
+
+        uint32_t hash = table->entries[i].key->hash;
+        int target = findInsertSlot(control, table->capacity, hash);
+
+        if(target / GROUP_SIZE == i / GROUP_SIZE) {
+            // already in the first group with room, leave it
+            control[i] = H2(hash);
+        } else if(control[target] == CTRL_EMPTY) {
+            control[target] = H2(hash);
+            table->entries[target] = table->entries[i];
+            control[i] = CTRL_EMPTY;
+            table->entries[i].key = NULL;
+            table->entries[i].value = NIL_VAL;
+        } else {
+            // target still holds an entry waiting to be placed: swap and
+            // look at slot i again
+            control[target] = H2(hash);
+            Entry displaced = table->entries[target];
+            table->entries[target] = table->entries[i];
+            table->entries[i] = displaced;
+            i--;
         }
+    }
 
+    table->tombstones = 0;
+}
 
-        index = (index + 1) & (table->capacity - 1);
+void tableCompact(Table* table) {
+    // shrink tables that emptied out, otherwise clear tombstones once they
+    // make up enough of the table to lengthen probes noticeably
+    int capacity = table->capacity;
+    while(capacity > 8 && table->count < capacity * TABLE_MIN_LOAD) {
+        capacity /= 2;
+    }
+
+    if(capacity < table->capacity) {
+        adjustCapacity(table, capacity);
+    } else if(table->tombstones > table->capacity * TABLE_MAX_TOMBSTONES) {
+        rehashInPlace(table);
     }
 }
 
-void tableRemoveWhite(Table* table) {
+void tableStats(Table* table, TableStats* stats) {
+    stats->count = table->count;
+    stats->tombstones = table->tombstones;
+    stats->capacity = table->capacity;
+    stats->averageProbe = 0;
+    stats->maxProbe = 0;
+
+    long totalProbe = 0;
     for(int i = 0; i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
-        if(entry->key != NULL && !entry->key->obj.isMarked) {
-            tableDelete(table, entry->key);
+        if(!IS_FULL(table->control[i])) continue;
+
+        int probe = 1;
+        FOR_EACH_PROBE_GROUP(table->capacity, table->entries[i].key->hash, base) {
+            if(base == i - i % GROUP_SIZE) break;
+            probe++;
         }
+
+        totalProbe += probe;
+        if(probe > stats->maxProbe) stats->maxProbe = probe;
     }
+
+    if(table->count > 0) stats->averageProbe = (double)totalProbe / table->count;
 }
 
 void markTable(Table* table) {
     for(int i = 0; i < table->capacity; i++) {
+        if(!IS_FULL(table->control[i])) continue;
+
         Entry* entry = &table->entries[i];
         markObject((Obj*)entry->key);
         markValue(entry->value);
     }
 }
+
+void forwardTable(Table* table) {
+    // keys hash by their contents, so moving them leaves entries in place
+    for(int i = 0; i < table->capacity; i++) {
+        if(!IS_FULL(table->control[i])) continue;
+
+        Entry* entry = &table->entries[i];
+        entry->key = (ObjString*)forwardObject((Obj*)entry->key);
+        entry->value = forwardValue(entry->value);
+    }
+}
+
+static uint32_t hashKey(Value key) {
+    // strings are interned, so everything except their contents hashes by
+    // representation: number bits, inline string bits or object identity
+#ifdef NAN_BOXING
+    if(IS_STRING(key)) return AS_STRING(key)->hash;
+    return hashWord(key, vm.hashSeed);
+#else
+    switch(key.type) {
+        case VAL_BOOL: return hashWord(AS_BOOL(key) ? 3 : 2, vm.hashSeed);
+        case VAL_NIL: return hashWord(1, vm.hashSeed);
+        case VAL_NUMBER: {
+            uint64_t bits;
+            double number = AS_NUMBER(key);
+            memcpy(&bits, &number, sizeof(bits));
+            return hashWord(bits, vm.hashSeed);
+        }
+        case VAL_OBJ:
+            if(IS_STRING(key)) return AS_STRING(key)->hash;
+            return hashWord((uint64_t)(uintptr_t)AS_OBJ(key), vm.hashSeed);
+    }
+    return 0;
+#endif
+}
+
+static inline bool keysEqual(Value a, Value b) {
+#ifdef NAN_BOXING
+    return a == b;
+#else
+    return valuesEqual(a, b);
+#endif
+}
+
+void initValueTable(ValueTable* table) {
+    table->count = 0;
+    table->tombstones = 0;
+    table->capacity = 0;
+    table->control = NULL;
+    table->entries = NULL;
+}
+
+void freeValueTable(ValueTable* table) {
+    freeControl(table->control, table->capacity);
+    FREE_ARRAY(ValueEntry, table->entries, table->capacity);
+    initValueTable(table);
+}
+
+static bool valueEntryHasKey(const void* entry, const void* key) {
+    return keysEqual(((const ValueEntry*)entry)->key, *(const Value*)key);
+}
+
+static uint32_t valueEntryHash(const void* entry) {
+    return hashKey(((const ValueEntry*)entry)->key);
+}
+
+int valueTableFind(ValueTable* table, Value key) {
+    if(table->count == 0) return -1;
+
+    return findSlot(table->control, table->capacity, table->entries, sizeof(ValueEntry),
+            hashKey(key), valueEntryHasKey, &key);
+}
+
+static void adjustValueCapacity(ValueTable* table, int capacity) {
+    reserveHeap(controlSize(capacity) + sizeof(ValueEntry) * capacity);
+    uint8_t* control = newControl(capacity);
+    ValueEntry* entries = ALLOCATE(ValueEntry, capacity);
+    for(int i = 0; i < capacity; i++) {
+        entries[i].key = NIL_VAL;
+        entries[i].value = NIL_VAL;
+    }
+
+    // the hash is recomputed, since a moved object key changes it
+    reinsertAll(table->control, table->entries, table->capacity, control, entries, capacity,
+            sizeof(ValueEntry), valueEntryHash);
+
+    freeControl(table->control, table->capacity);
+    FREE_ARRAY(ValueEntry, table->entries, table->capacity);
+    table->control = control;
+    table->entries = entries;
+    table->capacity = capacity;
+    table->tombstones = 0;
+}
+
+void forwardValueTable(ValueTable* table) {
+    // other objects hash by address, so a moved key means a rebuild
+    bool rehash = false;
+    for(int i = 0; i < table->capacity; i++) {
+        if(!IS_FULL(table->control[i])) continue;
+
+        ValueEntry* entry = &table->entries[i];
+        Value key = forwardValue(entry->key);
+        if(IS_OBJ(key) && !IS_STRING(key) && AS_OBJ(key) != AS_OBJ(entry->key)) rehash = true;
+        entry->key = key;
+        entry->value = forwardValue(entry->value);
+    }
+
+    if(rehash) adjustValueCapacity(table, table->capacity);
+}
+
+bool valueTableGet(ValueTable* table, Value key, Value* value) {
+    int index = valueTableFind(table, key);
+    if(index == -1) return false;
+
+    *value = table->entries[index].value;
+    return true;
+}
+
+void reserveValueTable(ValueTable* table) {
+    int capacity = insertCapacity(table->count, table->tombstones, table->capacity);
+    if(capacity != -1) reserveHeap(controlSize(capacity) + sizeof(ValueEntry) * capacity);
+}
+
+bool valueTableSet(ValueTable* table, Value key, Value value) {
+    int index = valueTableFind(table, key);
+    if(index != -1) {
+        table->entries[index].value = value;
+        return false;
+    }
+
+    int capacity = insertCapacity(table->count, table->tombstones, table->capacity);
+    if(capacity != -1) adjustValueCapacity(table, capacity);
+
+    index = claimSlot(table->control, table->capacity, &table->tombstones, hashKey(key));
+    table->entries[index].key = key;
+    table->entries[index].value = value;
+    table->count++;
+    return true;
+}
+
+bool valueTableDelete(ValueTable* table, Value key) {
+    int index = valueTableFind(table, key);
+    if(index == -1) return false;
+
+    if(clearControl(table->control, index)) table->tombstones++;
+    table->entries[index].key = NIL_VAL;
+    table->entries[index].value = NIL_VAL;
+    table->count--;
+    return true;
+}
+
+int valueTableNext(ValueTable* table, int index) {
+    // index of the first live slot at or after index, -1 past the end
+    for(; index < table->capacity; index++) {
+        if(IS_FULL(table->control[index])) return index;
+    }
+    return -1;
+}
+
+void markValueTable(ValueTable* table) {
+    for(int i = 0; i < table->capacity; i++) {
+        if(!IS_FULL(table->control[i])) continue;
+
+        markValue(table->entries[i].key);
+        markValue(table->entries[i].value);
+    }
+}
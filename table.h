@@ -9,12 +9,41 @@ typedef struct  {
     Value value;
 } Entry;
 
+// Open addressing in the style of SwissTable: every slot has a control
+// byte holding either EMPTY, DELETED or the low 7 bits of the key's hash.
+// Lookups scan the control bytes a group of 16 at a time and only touch
+// entries whose hash fragment matches.
 typedef struct {
-    int count;
+    int count;      // live entries
+    int tombstones; // DELETED slots, still part of probe sequences
     int capacity;
+    uint8_t* control;
     Entry* entries;
 } Table;
 
+// the same layout with arbitrary Value keys, backing ObjMap; keys must
+// already be normalized (strings interned, -0 folded to 0, no nil or NaN)
+typedef struct {
+    Value key;
+    Value value;
+} ValueEntry;
+
+typedef struct {
+    int count;
+    int tombstones;
+    int capacity;
+    uint8_t* control;
+    ValueEntry* entries;
+} ValueTable;
+
+typedef struct {
+    int count;
+    int tombstones;
+    int capacity;
+    double averageProbe; // groups scanned to reach a live entry
+    int maxProbe;
+} TableStats;
+
 void initTable(Table* table);
 void freeTable(Table* table);
 bool tableSet(Table* table, ObjString* key, Value value);
@@ -23,7 +52,22 @@ bool tableDelete(Table* table, ObjString* key);
 void tableAddAll(Table* from, Table* to);
 ObjString* tableFindString(Table* table, const char* chars,
                            int length, uint32_t hash);
-void tableRemoveWhite(Table* table);
+void tableRemoveWhite(Table* table, bool youngOnly);
+void tableCompact(Table* table);
+void tableStats(Table* table, TableStats* stats);
 void markTable(Table* table);
+void forwardTable(Table* table);
+
+void initValueTable(ValueTable* table);
+void freeValueTable(ValueTable* table);
+bool valueTableGet(ValueTable* table, Value key, Value* value);
+bool valueTableSet(ValueTable* table, Value key, Value value);
+// as reserveValueArray, for one more key
+void reserveValueTable(ValueTable* table);
+bool valueTableDelete(ValueTable* table, Value key);
+int valueTableFind(ValueTable* table, Value key);
+int valueTableNext(ValueTable* table, int index);
+void markValueTable(ValueTable* table);
+void forwardValueTable(ValueTable* table);
 
 #endif
@@ -10,11 +10,14 @@ bool valuesEqual(Value a, Value b) {
     if(IS_NUMBER(a) && IS_NUMBER(b)) {
         return AS_NUMBER(a) == AS_NUMBER(b);
     }
-    return a == b;
+    if(a == b) return true;
+    return IS_STRING(a) && IS_STRING(b) && stringsEqual(AS_STRING(a), AS_STRING(b));
 #else
     if(a.type != b.type) return false;
     switch(a.type) {
-        case VAL_OBJ:  return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_OBJ:
+            if(AS_OBJ(a) == AS_OBJ(b)) return true;
+            return IS_STRING(a) && IS_STRING(b) && stringsEqual(AS_STRING(a), AS_STRING(b));
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
         case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL: return true;
@@ -31,15 +34,23 @@ void initValueArray(ValueArray* array) {
 
 void writeValueArray(ValueArray* array, Value value) {
     if(array->capacity < array->count+ 1) {
-        int oldCapacity = array->capacity;
-        array->capacity = GROW_CAPACITY(oldCapacity);
-        array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
+        // the capacity is updated only once the buffer is, since going
+        // over the heap limit unwinds out of GROW_ARRAY
+        int capacity = GROW_CAPACITY(array->capacity);
+        array->values = GROW_ARRAY(Value, array->values, array->capacity, capacity);
+        array->capacity = capacity;
     }
 
     array->values[array->count] = value;
     array->count++;
 }
 
+void reserveValueArray(ValueArray* array) {
+    if(array->capacity < array->count + 1) {
+        reserveHeap(sizeof(Value) * (GROW_CAPACITY(array->capacity) - array->capacity));
+    }
+}
+
 void freeValueArray(ValueArray* array) {
     FREE_ARRAY(Value, array->values, array->capacity);
     initValueArray(array);
@@ -55,6 +66,10 @@ void printValue(Value value) {
         printf("nil");
     } else if (IS_NUMBER(value)){
         printf("%g", AS_NUMBER(value));
+    } else if(IS_SMALL_STRING(value)) {
+        char chars[SMALL_STRING_MAX + 1];
+        int length = smallStringChars(value, chars);
+        fwrite(chars, sizeof(char), length, stdout);
     }
 #else
     switch(value.type) {
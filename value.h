@@ -29,10 +29,19 @@ typedef uint64_t Value;
 #define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
 #define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
 
+// strings of up to SMALL_STRING_MAX bytes are stored in the NaN payload:
+// bit 49 tags them, bits 40-42 hold the length and the low 40 bits the
+// characters, first character in the lowest byte
+#define SMALL_STRING_MAX 5
+#define SMALL_STRING_TAG ((uint64_t)1 << 49)
+#define FITS_SMALL_STRING(length) ((length) <= SMALL_STRING_MAX)
+
 #define IS_BOOL(value)   ((value | 1) == TRUE_VAL)
 #define IS_NIL(value)    (value == NIL_VAL)
 #define IS_NUMBER(value) ((value & QNAN) != QNAN)
 #define IS_OBJ(value)    ((value & (QNAN | SIG_BIT)) == (QNAN | SIG_BIT))
+#define IS_SMALL_STRING(value) \
+    (((value) & (SIG_BIT | QNAN | SMALL_STRING_TAG)) == (QNAN | SMALL_STRING_TAG))
 
 #define AS_BOOL(value)   (value == TRUE_VAL)
 #define AS_NUMBER(value) valToNum(value)
@@ -56,6 +65,27 @@ static inline double valToNum(Value value) {
     return num;
 }
 
+static inline Value smallStringVal(const char* chars, int length) {
+    uint64_t bits = 0;
+    for(int i = 0; i < length; i++) {
+        bits |= (uint64_t)(uint8_t)chars[i] << (8 * i);
+    }
+    return QNAN | SMALL_STRING_TAG | ((uint64_t)length << 40) | bits;
+}
+
+static inline int smallStringLength(Value value) {
+    return (int)((value >> 40) & 0x7);
+}
+
+static inline int smallStringChars(Value value, char* buffer) {
+    int length = smallStringLength(value);
+    for(int i = 0; i < length; i++) {
+        buffer[i] = (char)(value >> (8 * i));
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
 #else 
 
 typedef struct {
@@ -72,6 +102,11 @@ typedef struct {
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 
+// without NaN boxing there is no room for inline strings
+#define SMALL_STRING_MAX 0
+#define FITS_SMALL_STRING(length) false
+#define IS_SMALL_STRING(value) false
+
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
 #define AS_OBJ(value) ((value).as.obj)
@@ -81,6 +116,19 @@ typedef struct {
 #define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
 
+static inline Value smallStringVal(const char* chars, int length) {
+    return NIL_VAL;
+}
+
+static inline int smallStringLength(Value value) {
+    return 0;
+}
+
+static inline int smallStringChars(Value value, char* buffer) {
+    buffer[0] = '\0';
+    return 0;
+}
+
 #endif
 
 typedef struct {
@@ -93,6 +141,10 @@ typedef struct {
 bool valuesEqual(Value a, Value b);
 void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
+// checks the room one more value needs against the heap limit; for
+// callers about to write inside a mutation, where the limit cannot
+// collect to make room
+void reserveValueArray(ValueArray* array);
 void freeValueArray(ValueArray* array);
 void printValue(Value value);
 
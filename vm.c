@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
@@ -7,8 +8,11 @@
 #include "compiler.h"
 #include "object.h"
 #include "debug.h"
+#include "hash.h"
 #include "vm.h"
 #include "memory.h"
+#include "native.h"
+#include "profile.h"
 
 VM vm;
 
@@ -31,8 +35,16 @@ VM vm;
 /* #endif */
 /* } */
 
-static Value clockNative(int argCount, Value* args) {
-    return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+static uint64_t initialHashSeed() {
+    // CLOX_HASH_SEED pins the seed to reproduce a run; otherwise mix the
+    // clock with an ASLR-randomized address so each process differs
+    const char* fixed = getenv("CLOX_HASH_SEED");
+    if(fixed != NULL) return strtoull(fixed, NULL, 0);
+
+    uint64_t seed = (uint64_t)time(NULL);
+    seed ^= (uint64_t)(uintptr_t)&vm << 16;
+    seed ^= (uint64_t)clock();
+    return hashBytes((const char*)&seed, sizeof(seed), 0);
 }
 
 static void resetStack(){
@@ -41,7 +53,7 @@ static void resetStack(){
     vm.openUpvalues = NULL;
 }
 
-static void runtimeError(const char* format, ...) {
+void runtimeError(const char* format, ...) {
     va_list args;
     va_start(args, format);
     vfprintf(stderr, format, args);
@@ -64,18 +76,82 @@ static void runtimeError(const char* format, ...) {
     resetStack();
 }
 
-static void defineNative(const char* name, NativeFn function) {
-    push(OBJ_VAL(copyString(name, (int)strlen(name))));
-    push(OBJ_VAL(newNative(function)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+void outOfMemoryError(bool atLimit) {
+    // the failed allocation could be anywhere in the compiler, the VM or a
+    // native, so rather than have every caller check, the error unwinds
+    // straight back to interpret(). A collection that runs out is not
+    // unwound: it may have moved or forwarded only part of the heap
+    if(vm.errorJump == NULL || vm.gcRunning) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+
+    vm.mutationDepth = 0;
+    if(vm.heapLocked) {
+        vm.heapLocked = false;
+        pthread_mutex_unlock(&vm.heapLock);
+    }
+
+    if(atLimit) {
+        runtimeError("Out of memory: heap limit of %zu bytes reached.", vm.gcMaxHeap);
+    } else {
+        runtimeError("Out of memory.");
+    }
+    resetCompiler();
+    longjmp(*vm.errorJump, 1);
+}
+
+static void defineGlobal(ObjString* name, Value value) {
+    int symbol = name->symbol;
+    if(vm.globalCapacity < symbol + 1) {
+        int oldCapacity = vm.globalCapacity;
+        int capacity = GROW_CAPACITY(oldCapacity);
+        while(capacity < symbol + 1) capacity *= 2;
+
+        // both arrays are resized before the capacity is published so a
+        // GC triggered in between only ever walks initialized slots
+        reserveHeap((sizeof(ObjString*) + sizeof(Value)) * (capacity - oldCapacity));
+        vm.globalNames = GROW_ARRAY(ObjString*, vm.globalNames, oldCapacity, capacity);
+        vm.globalValues = GROW_ARRAY(Value, vm.globalValues, oldCapacity, capacity);
+        for(int i = oldCapacity; i < capacity; i++) {
+            vm.globalNames[i] = NULL;
+            vm.globalValues[i] = NIL_VAL;
+        }
+        vm.globalCapacity = capacity;
+    }
+
+    vm.globalNames[symbol] = name;
+    vm.globalValues[symbol] = value;
+}
+
+static bool isGlobalDefined(ObjString* name) {
+    return name->symbol < vm.globalCapacity && vm.globalNames[name->symbol] != NULL;
+}
+
+void defineNative(const char* name, int arity, NativeFn function) {
+    push(OBJ_VAL(copySymbol(name, (int)strlen(name))));
+    push(OBJ_VAL(newNative(function, arity)));
+    defineGlobal(AS_STRING(vm.stack[0]), vm.stack[1]);
     pop();
     pop();
 }
 
 void initVM(){
     resetStack();
+    vm.printCode = false;
+    vm.traceExecution = false;
+    vm.stressGC = false;
+    vm.gcLog = false;
+    vm.profileOps = false;
+
     vm.objectCount = 0;
-    vm.objects = NULL;
+    for(int i = 0; i < HEAP_CLASS_COUNT; i++) {
+        vm.sizeClasses[i].pages = NULL;
+        vm.sizeClasses[i].available = NULL;
+    }
+    vm.youngObjects = NULL;
+    vm.youngCapacity = 0;
+    vm.youngCount = 0;
 
     vm.grayStack = NULL;
     vm.grayCount = 0;
@@ -83,21 +159,70 @@ void initVM(){
 
     vm.bytesAllocated = 0;
     vm.nextGCAt = 1024 * 1024;
+    vm.gcGrowFactor = 2;
+    vm.gcMinHeap = 0;
+    vm.gcMaxHeap = 0;
+    vm.youngBytes = 0;
+    vm.gcRunning = false;
+    vm.gcMoving = false;
+    vm.gcMinor = false;
+    vm.minorCollections = 0;
+    vm.majorCollections = 0;
+
+    vm.gcIncremental = false;
+    vm.gcPauseBudget = 1000 * 1000;
+    vm.gcPhase = GC_IDLE;
+    vm.gcDebt = 0;
+    vm.sweepClass = 0;
+    vm.sweepPage = NULL;
+    memset(&vm.minorPauses, 0, sizeof(PauseStats));
+    memset(&vm.majorPauses, 0, sizeof(PauseStats));
+    memset(&vm.sweepPauses, 0, sizeof(PauseStats));
+    vm.bytesFreed = 0;
+    vm.objectsFreed = 0;
+    vm.heapAfterGC = 0;
+    vm.peakBytes = 0;
+
+    vm.gcCompact = false;
+    vm.compactRequested = false;
+    vm.compactions = 0;
+    vm.objectsMoved = 0;
+
+    vm.gcThreads = 1;
+
+    vm.gcConcurrent = false;
+    vm.markerActive = false;
+    vm.markDone = false;
+    pthread_mutex_init(&vm.heapLock, NULL);
+    vm.heapWaiters = 0;
+    vm.mutationDepth = 0;
+    vm.heapLocked = false;
+
+    vm.remembered = NULL;
+    vm.rememberedCapacity = 0;
+    vm.rememberedCount = 0;
 
     initTable(&vm.strings);
-    initTable(&vm.globals);
+    vm.hashSeed = initialHashSeed();
+    vm.errorJump = NULL;
+    vm.symbolCount = 0;
+    vm.globalCapacity = 0;
+    vm.globalNames = NULL;
+    vm.globalValues = NULL;
     vm.initString = NULL;
-    vm.initString = copyString("init", 4);
-
+    vm.initString = copySymbol("init", 4);
 
-    defineNative("clock", clockNative);
+    defineNatives();
 }
 
 void freeVM(){
-    freeTable(&vm.globals);
+    FREE_ARRAY(ObjString*, vm.globalNames, vm.globalCapacity);
+    FREE_ARRAY(Value, vm.globalValues, vm.globalCapacity);
+    vm.globalCapacity = 0;
     freeTable(&vm.strings);
     vm.initString = NULL;
     freeObjects();
+    pthread_mutex_destroy(&vm.heapLock);
 }
 
 void push(Value value) {
@@ -127,10 +252,14 @@ static bool call(ObjClosure* closure, int argCount) {
         return false;
     }
 
-    CallFrame* frame = &vm.frames[vm.frameCount++]; // new frame
+    // the sampler may look at the frames between any two instructions,
+    // so the new one is filled in before it is counted
+    CallFrame* frame = &vm.frames[vm.frameCount]; // new frame
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
     frame->slots = vm.stackTop - argCount - 1;
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    vm.frameCount++;
     return true;
 }
 
@@ -159,10 +288,16 @@ static bool callValue(Value callee, int argCount) {
                 return true;
             }
             case OBJ_NATIVE: {
-                NativeFn native = AS_NATIVE(callee);
-                Value result = native(argCount, vm.stackTop - argCount);
-                vm.stackTop -= argCount + 1;
-                push(result);
+                ObjNative* native = AS_NATIVE(callee);
+                if(native->arity != -1 && native->arity != argCount) {
+                    runtimeError("Expected %d arguments but got %d", native->arity, argCount);
+                    return false;
+                }
+
+                if(!native->function(argCount, vm.stackTop - argCount)) {
+                    return false;
+                }
+                vm.stackTop -= argCount;
                 return true;
              }
             case OBJ_CLOSURE: 
@@ -179,28 +314,129 @@ static bool isFalsy(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+static bool indexSlot(Value index, int count, int* slot) {
+    if(!IS_NUMBER(index)) {
+        runtimeError("Index must be a number.");
+        return false;
+    }
+
+    double number = AS_NUMBER(index);
+    if(!(number >= 0 && number < count)) {
+        runtimeError("Index %g out of bounds for length %d.", number, count);
+        return false;
+    }
+    if(number != (int)number) {
+        runtimeError("Index must be an integer.");
+        return false;
+    }
+
+    *slot = (int)number;
+    return true;
+}
+
+static bool getIndex() {
+    // slow path of OP_GET_INDEX: string indexing and error reporting
+    Value target = peek(1);
+    int slot;
+
+    if(IS_LIST(target)) {
+        if(!indexSlot(peek(0), AS_LIST(target)->items.count, &slot)) return false;
+        Value value = AS_LIST(target)->items.values[slot];
+        vm.stackTop -= 2;
+        push(value);
+        return true;
+    }
+
+    if(IS_FLOAT_ARRAY(target)) {
+        if(!indexSlot(peek(0), AS_FLOAT_ARRAY(target)->count, &slot)) return false;
+        double number = AS_FLOAT_ARRAY(target)->values[slot];
+        vm.stackTop -= 2;
+        push(NUMBER_VAL(number));
+        return true;
+    }
+
+    if(IS_ANY_STRING(target)) {
+        if(!indexSlot(peek(0), stringValueLength(target), &slot)) return false;
+        char buffer[SMALL_STRING_MAX + 1];
+        const char* chars = stringValueChars(target, buffer);
+        Value value = copyStringValue(chars + slot, 1);
+        vm.stackTop -= 2;
+        push(value);
+        return true;
+    }
+
+    runtimeError("Only lists, float arrays and strings can be indexed.");
+    return false;
+}
+
+static ObjString* heapStringAt(int distance) {
+    // ropes are built from ObjStrings, so give an inline operand a heap
+    // copy and swap it into its stack slot to keep it reachable
+    Value value = peek(distance);
+    if(IS_STRING(value)) return AS_STRING(value);
+
+    char buffer[SMALL_STRING_MAX + 1];
+    int length = smallStringChars(value, buffer);
+    char* chars = ALLOCATE(char, length + 1);
+    memcpy(chars, buffer, length + 1);
+    ObjString* string = takeString(chars, length);
+    vm.stackTop[-1 - distance] = OBJ_VAL(string);
+    return string;
+}
+
 static void concatenate() {
     // concatenates two strings at the top of the stack and pushes a new string 
-    ObjString* second = AS_STRING(peek(0));
-    ObjString* first = AS_STRING(peek(1));
-    int length = first->length + second->length;
-    char* concatString = ALLOCATE(char, length + 1);
-    strcpy(concatString, first->chars);
-    strcat(concatString, second->chars);
-
-    ObjString* result = takeString(concatString, length);
+    int secondLength = stringValueLength(peek(0));
+    int firstLength = stringValueLength(peek(1));
+    int length = firstLength + secondLength;
+
+    Value result;
+    if(firstLength == 0) {
+        result = peek(0);
+    } else if(secondLength == 0) {
+        result = peek(1);
+    } else if(length < ROPE_MIN_LENGTH) {
+        // short operands are never ropes, so reading them doesn't allocate
+        char firstBuffer[SMALL_STRING_MAX + 1];
+        char secondBuffer[SMALL_STRING_MAX + 1];
+        const char* first = stringValueChars(peek(1), firstBuffer);
+        const char* second = stringValueChars(peek(0), secondBuffer);
+
+        if(FITS_SMALL_STRING(length)) {
+            char chars[SMALL_STRING_MAX + 1];
+            memcpy(chars, first, firstLength);
+            memcpy(chars + firstLength, second, secondLength);
+            result = smallStringVal(chars, length);
+        } else {
+            char* concatString = ALLOCATE(char, length + 1);
+            memcpy(concatString, first, firstLength);
+            memcpy(concatString + firstLength, second, secondLength);
+            concatString[length] = '\0';
+            result = OBJ_VAL(takeString(concatString, length));
+        }
+    } else {
+        // defer copying until the characters are needed, which keeps
+        // building a string in a loop linear
+        ObjString* second = heapStringAt(0);
+        ObjString* first = heapStringAt(1);
+        result = OBJ_VAL(newRope(first, second));
+    }
+
     pop();
     pop();
-    push(OBJ_VAL(result));
+    push(result);
 }
 
 static void closeUpvalues(Value* last) {
+    beginMutation();
     while(vm.openUpvalues != NULL && vm.openUpvalues->location >= last) {
         ObjUpvalue* upvalue = vm.openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
+        writeBarrier((Obj*)upvalue);
         vm.openUpvalues = upvalue->next;
     }
+    endMutation();
 }
 
 static ObjUpvalue* captureUpvalue(Value* local) {
@@ -234,7 +470,10 @@ static ObjUpvalue* captureUpvalue(Value* local) {
 
 static void defineMethod(ObjString* name) {
     ObjClass* klass = AS_CLASS(peek(1));
+    beginMutation();
     tableSet(&klass->methods, name, peek(0));
+    writeBarrier((Obj*)klass);
+    endMutation();
     pop();
 }
 
@@ -283,8 +522,28 @@ static bool invoke(ObjString* name, int argCount) {
     return invokeFromClass(instance->klass, name, argCount);
 }
 
-static InterpretResult run() {
+static void traceInstruction(CallFrame* frame) {
+    printf("          ");
+
+    for(Value* slot = vm.stack; slot < vm.stackTop ; slot++) {
+        printf("[ ");
+        printValue(*slot);
+        printf(" ]");
+    }
+
+    printf("\n");
+
+    disassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
+}
+
+// The dispatch loop is inlined into one copy per combination of the
+// per-instruction diagnostics, with the flags as constants, so the copy
+// used normally has no checks in it at all. run() picks the copy once.
+static inline __attribute__((always_inline)) InterpretResult runLoop(bool trace, bool profile) {
     CallFrame* frame = &vm.frames[vm.frameCount-1];
+    // the frame depth and opcode as of the last instruction profiled
+    int profiledDepth = 0;
+    int previous = -1;
 #define READ_BYTE() (*frame->ip++)
 #define READ_SHORT() \
     (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
@@ -302,23 +561,83 @@ static InterpretResult run() {
     } while(false) 
 
     for(;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-        printf("          ");
+        if(trace) traceInstruction(frame);
 
-        for(Value* slot = vm.stack; slot < vm.stackTop ; slot++) {
-            printf("[ ");
-            printValue(*slot);
-            printf(" ]");
+        uint8_t instruction = READ_BYTE();
+        if(profile) {
+            profileInstruction(frame->closure->function, instruction, previous, vm.frameCount > profiledDepth);
+            profiledDepth = vm.frameCount;
+            previous = instruction;
         }
 
-        printf("\n");
-
-        disassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
-#endif
+        switch(instruction) {
+            case OP_BUILD_LIST: {
+                                    int count = READ_BYTE();
+                                    ObjList* list = newList();
+                                    push(OBJ_VAL(list));
+                                    // the items stay on the stack while the buffer is allocated
+                                    if(count > 0) {
+                                        Value* values = GROW_ARRAY(Value, NULL, 0, count);
+                                        beginMutation();
+                                        list->items.values = values;
+                                        list->items.capacity = count;
+                                        memcpy(values, vm.stackTop - 1 - count, sizeof(Value) * count);
+                                        list->items.count = count;
+                                        writeBarrier((Obj*)list);
+                                        endMutation();
+                                    }
+                                    vm.stackTop -= count + 1;
+                                    push(OBJ_VAL(list));
+                                    break;
+                                }
+            case OP_GET_INDEX: {
+                                   Value target = peek(1);
+                                   Value index = peek(0);
+                                   if(IS_LIST(target) && IS_NUMBER(index)) {
+                                       ValueArray* items = &AS_LIST(target)->items;
+                                       double number = AS_NUMBER(index);
+                                       if(number >= 0 && number < items->count && number == (int)number) {
+                                           vm.stackTop--;
+                                           vm.stackTop[-1] = items->values[(int)number];
+                                           break;
+                                       }
+                                   }
 
-        uint8_t instruction;
+                                   if(!getIndex()) return INTERPRET_RUNTIME_ERROR;
+                                   break;
+                               }
+            case OP_SET_INDEX: {
+                                   Value target = peek(2);
+                                   int slot;
+                                   if(IS_LIST(target)) {
+                                       ValueArray* items = &AS_LIST(target)->items;
+                                       if(!indexSlot(peek(1), items->count, &slot)) {
+                                           return INTERPRET_RUNTIME_ERROR;
+                                       }
+                                       beginMutation();
+                                       items->values[slot] = peek(0);
+                                       writeBarrier((Obj*)AS_LIST(target));
+                                       endMutation();
+                                   } else if(IS_FLOAT_ARRAY(target)) {
+                                       ObjFloatArray* array = AS_FLOAT_ARRAY(target);
+                                       if(!indexSlot(peek(1), array->count, &slot)) {
+                                           return INTERPRET_RUNTIME_ERROR;
+                                       }
+                                       if(!IS_NUMBER(peek(0))) {
+                                           runtimeError("Float array elements must be numbers.");
+                                           return INTERPRET_RUNTIME_ERROR;
+                                       }
+                                       array->values[slot] = AS_NUMBER(peek(0));
+                                   } else {
+                                       runtimeError("Only lists and float arrays support index assignment.");
+                                       return INTERPRET_RUNTIME_ERROR;
+                                   }
 
-        switch(instruction = READ_BYTE()) {
+                                   Value value = pop();
+                                   vm.stackTop -= 2;
+                                   push(value);
+                                   break;
+                               }
             case OP_SUPER_INVOKE: {
                                       ObjClass* super = AS_CLASS(pop());
                                       ObjString* method = READ_STRING();
@@ -348,7 +667,10 @@ static InterpretResult run() {
 
                                  ObjClass* klass = AS_CLASS(peek(0));
                                     
+                                 beginMutation();
                                  tableAddAll(&AS_CLASS(super)->methods, &klass->methods);
+                                 writeBarrier((Obj*)klass);
+                                 endMutation();
 
                                  pop();
 
@@ -375,7 +697,10 @@ static InterpretResult run() {
                                       }
 
                                       ObjInstance* instance = AS_INSTANCE(peek(1));
+                                      beginMutation();
                                       tableSet(&instance->fields, READ_STRING(), peek(0));
+                                      writeBarrier((Obj*)instance);
+                                      endMutation();
                                       Value newValue = pop();
                                       pop();
                                       push(newValue);
@@ -416,7 +741,11 @@ static InterpretResult run() {
                                    }
             case OP_SET_UPVALUE: {
                                      uint8_t index = READ_BYTE();
-                                     *frame->closure->upvalues[index]->location = peek(0); // an expression; don't pop
+                                     ObjUpvalue* upvalue = frame->closure->upvalues[index];
+                                     beginMutation();
+                                     *upvalue->location = peek(0); // an expression; don't pop
+                                     writeBarrier((Obj*)upvalue);
+                                     endMutation();
                                      break;
                                  }
             case OP_GET_UPVALUE: {
@@ -435,6 +764,8 @@ static InterpretResult run() {
             case OP_LOOP: {
                               uint16_t offset = READ_SHORT();
                               frame->ip -= offset;
+                              // a safe point: no C local holds an object
+                              if(vm.compactRequested) compactHeap();
                               break;
                           }
             case OP_JUMP: {
@@ -459,27 +790,26 @@ static InterpretResult run() {
                                }
             case OP_SET_GLOBAL: {
                                      ObjString* name = READ_STRING();
-                                     if(tableSet(&vm.globals, name, peek(0))) {
-                                         tableDelete(&vm.globals, name);
+                                     if(!isGlobalDefined(name)) {
                                          runtimeError("Undefined variable '%s'.", name->chars);
                                          return INTERPRET_RUNTIME_ERROR;
                                      }
+                                     vm.globalValues[name->symbol] = peek(0);
                                      break;
                                 }
             case OP_GET_GLOBAL:  {
                                      ObjString* name = READ_STRING();
-                                     Value value;
-                                     if(!tableGet(&vm.globals, name, &value)) {
+                                     if(!isGlobalDefined(name)) {
                                          runtimeError("Undefined variable '%s'.", name->chars);
                                          return INTERPRET_RUNTIME_ERROR;
                                      }
 
-                                     push(value);
+                                     push(vm.globalValues[name->symbol]);
                                      break;
                                  }
             case OP_DEFINE_GLOBAL: {
                                        ObjString* name = READ_STRING();
-                                       tableSet(&vm.globals, name, peek(0));
+                                       defineGlobal(name, peek(0));
                                        pop();
                                        break;
                                    }
@@ -506,7 +836,7 @@ static InterpretResult run() {
                                 double b = AS_NUMBER(pop()); 
                                 double a = AS_NUMBER(pop()); 
                                 push(NUMBER_VAL(a + b)); 
-                            } else if(IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+                            } else if(IS_ANY_STRING(peek(0)) && IS_ANY_STRING(peek(1))) {
                                 concatenate();
                             } else {
                                 runtimeError("Operands must be two numbers or two strings.");
@@ -529,6 +859,9 @@ static InterpretResult run() {
                                  ObjClosure* closure = newClosure(function);
                                  push(OBJ_VAL(closure));
 
+                                 // a cycle started by capturing scans the closure as a
+                                 // root, and the marker may be tracing it already
+                                 beginMutation();
                                  for(int i = 0; i < function->upvalueCount; i++) {
                                      uint8_t isLocal = READ_BYTE();
                                      uint8_t index = READ_BYTE();
@@ -538,6 +871,9 @@ static InterpretResult run() {
                                          closure->upvalues[i] = frame->closure->upvalues[index];
                                      }
                                  }
+                                 // capturing allocates, which may have promoted the closure
+                                 writeBarrier((Obj*)closure);
+                                 endMutation();
 
                                  break;
                              }
@@ -571,18 +907,47 @@ static InterpretResult run() {
 #undef BINARY_OP
 }
 
-InterpretResult interpret(const char* source) {
-    ObjFunction* function = compile(source);
-    if(function == NULL) { return INTERPRET_COMPILE_ERROR; }
+// kept out of line, or both copies end up inside run() and the plain one
+// loses registers to the other
+static __attribute__((noinline)) InterpretResult runPlain() {
+    return runLoop(false, false);
+}
+
+static __attribute__((noinline)) InterpretResult runTraced() {
+    return runLoop(true, false);
+}
+
+static __attribute__((noinline)) InterpretResult runProfiled() {
+    // slow enough already that tracing can be left to a check
+    return runLoop(vm.traceExecution, true);
+}
+
+static InterpretResult run() {
+    if(vm.profileOps) return runProfiled();
+    return vm.traceExecution ? runTraced() : runPlain();
+}
 
-    push(OBJ_VAL(function));
-    ObjClosure* closure = newClosure(function);
-    pop(); // GC hack
-    push(OBJ_VAL(closure));
-    call(closure, 0);
+InterpretResult interpret(const char* source) {
+    jmp_buf errorJump;
+    if(setjmp(errorJump) != 0) {
+        vm.errorJump = NULL;
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    vm.errorJump = &errorJump;
 
-    InterpretResult result = run();
+    InterpretResult result = INTERPRET_COMPILE_ERROR;
+    ObjFunction* function = compile(source);
+    if(function != NULL) {
+        push(OBJ_VAL(function));
+        ObjClosure* closure = newClosure(function);
+        pop(); // GC hack
+        push(OBJ_VAL(closure));
+        call(closure, 0);
+
+        result = run();
+    }
 
+    vm.errorJump = NULL;
     return result;
 }
 
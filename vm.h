@@ -1,9 +1,13 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
+#include <pthread.h>
+#include <setjmp.h>
+
 #include "value.h"
 #include "table.h"
 #include "object.h"
+#include "heap.h"
 
 #define FRAMES_MAX 64
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
@@ -14,12 +18,99 @@ typedef struct {
     Value* slots;
 } CallFrame;
 
+typedef enum {
+    GC_IDLE,
+    GC_MARK,
+    GC_SWEEP,
+} GCPhase;
+
+// bucket i counts pauses shorter than 2^i microseconds, and the last one
+// everything longer
+#define GC_PAUSE_BUCKETS 20
+
+typedef struct {
+    int count;
+    uint64_t totalNanos;
+    uint64_t maxNanos;
+    int buckets[GC_PAUSE_BUCKETS];
+} PauseStats;
+
 typedef struct{
     ObjString* initString;
 
+    // diagnostics, off unless asked for on the command line
+    bool printCode; // disassemble each function as it is compiled
+    bool traceExecution; // print the stack and each instruction as it runs
+    bool stressGC; // collect on every allocation
+    bool gcLog; // report what the collector does
+    bool profileOps; // count opcodes, opcode pairs and calls (see profile.h)
+
     // adapative GC scheduling
     size_t bytesAllocated;
     size_t nextGCAt;
+    size_t youngBytes; // allocated since the last collection of any kind
+    bool gcRunning;
+    bool gcMoving; // compaction is moving objects and fixing references to them
+    bool gcMinor; // the running collection only traces young objects
+    int minorCollections;
+    int majorCollections;
+
+    // collection policy, set from the command line or the environment
+    // (see main.c). The next major collection is due once the heap has
+    // grown by gcGrowFactor, but never below gcMinHeap. A nonzero
+    // gcMaxHeap is a hard limit: an allocation that would pass it gets a
+    // full collection, then an out of memory error if that was not enough
+    double gcGrowFactor;
+    size_t gcMinHeap;
+    size_t gcMaxHeap;
+
+    // incremental major collections, enabled by giving a pause budget
+    bool gcIncremental;
+    uint64_t gcPauseBudget; // nanoseconds per step
+    GCPhase gcPhase;
+    size_t gcDebt; // allocated since the last step
+    // the lazy sweep walks each size class in turn; pages added since
+    // the cycle's mark finished are never marked as needing a sweep
+    int sweepClass;
+    Page* sweepPage;
+
+    // GC telemetry, kept whether or not anything reports it. Sweeping is
+    // spread over allocations, so sweepPauses is what it would otherwise
+    // have added to the major pauses
+    PauseStats minorPauses;
+    PauseStats majorPauses;
+    PauseStats sweepPauses;
+    size_t bytesFreed;
+    size_t objectsFreed;
+    size_t heapAfterGC; // bytesAllocated when the last collection finished
+    size_t peakBytes;
+
+    // compaction: when a major collection leaves the pages sparse, the
+    // next safe point in run() moves objects out of the emptiest ones
+    bool gcCompact;
+    bool compactRequested;
+    int compactions;
+    size_t objectsMoved;
+
+    // threads sharing the mark of a stop-the-world major collection
+    int gcThreads;
+
+    // concurrent marking: a cycle's mark phase runs on a helper thread
+    // while the mutator keeps going (see beginMutation in memory.h)
+    bool gcConcurrent;
+    bool markerActive; // only touched by the main thread
+    bool markDone; // guarded by heapLock
+    pthread_t marker;
+    pthread_mutex_t heapLock;
+    int heapWaiters; // mutations blocked on heapLock, read by the marker
+    int mutationDepth;
+    bool heapLocked;
+
+    // old objects that had a reference stored into them since the last
+    // collection; a minor collection scans them as extra roots
+    Obj** remembered;
+    int rememberedCapacity;
+    int rememberedCount;
     
     // dyanmic array for GC tricolor abstraction
     Obj** grayStack;
@@ -32,9 +123,24 @@ typedef struct{
     Value stack[STACK_MAX];
     Value* stackTop;
     Table strings;
-    Table globals;
+    uint64_t hashSeed;
+    jmp_buf* errorJump; // where an out of memory error unwinds to
+
+    // globals live in slots indexed by the symbol id of their name;
+    // a NULL name marks a slot that has not been defined yet
+    int symbolCount;
+    int globalCapacity;
+    ObjString** globalNames;
+    Value* globalValues;
+
     int objectCount;
-    Obj* objects; // head of the instrusive list of objects which act as nodes in lined list
+    SizeClass sizeClasses[HEAP_CLASS_COUNT]; // the object heap, see heap.h
+
+    // objects allocated since the last collection; every other object is
+    // old and is only found by walking the pages
+    Obj** youngObjects;
+    int youngCapacity;
+    int youngCount;
 } VM;
 
 typedef enum{
@@ -50,5 +156,9 @@ void freeVM();
 InterpretResult interpret(const char* source);
 void push(Value value);
 Value pop();
+void runtimeError(const char* format, ...);
+// atLimit: the allocation would have gone over vm.gcMaxHeap
+void outOfMemoryError(bool atLimit);
+void defineNative(const char* name, int arity, NativeFn function);
 
 #endif